@@ -21,12 +21,29 @@
 import torch
 import numpy as np
 from tiling import Tiling
+from tiling import print_tiler_statistics
+from tiling import run_tiling_job
+from tiling import TILER_STATISTICS
+from tiling_cache import Tiling_cache
+from cost_model import Cost_model
+from tiling_exploration import Tiling_exploration
+from network_tiling import Network_tiling
+from memory_planning import L2_memory_planner
+from memory_planning import L3_memory_planner
+from memory_planning import tensor_lifetimes
+from memory_planning import live_across
+from memory_planning import last_read
+from memory_planning import consumers
+from memory_planning import has_weights
+from memory_planning import weights_bytes
 import template as template
 import os
 import pandas as pd
 from mako.template import Template
 from collections import OrderedDict
 import logging
+import concurrent.futures
+import multiprocessing
 
 class Model_deployment():
     """
@@ -36,6 +53,10 @@ class Model_deployment():
     def __init__(self, platform, chip):
         self.platform = platform
         self.chip = chip
+        self.tiling_cache = None
+        self.cost_model = None
+        self.tiling_exploration = None
+        self.cp_baseline = False
 
     def copy_files(self, optional, layer_mixed_list,version, sdk, dma_parallelization):
         ## copy backend and necessary files in the application folder
@@ -171,6 +192,178 @@ class Model_deployment():
         version = str(BitActivation) + 'bit'
         self.copy_files(optional, layer_mixed_list, version, sdk, dma_parallelization)
 
+    def fusable(self, dw, pw, optional, PULP_Nodes_Graph):
+        # depthwise followed by a 1x1 pointwise reading only its output, 8 bits, batch-norm and relu on both
+        if optional != '8bit':
+            return False
+        if 'DW' not in dw.name or 'Conv' not in dw.name or dw.groups == 1:
+            return False
+        if 'Conv' not in pw.name or 'DW' in pw.name or pw.groups != 1 or pw.conv_1d == 1:
+            return False
+        if pw.filter_size_h != 1 or pw.filter_size_w != 1 or pw.stride != 1:
+            return False
+        if pw.padding_top + pw.padding_bottom + pw.padding_left + pw.padding_right != 0:
+            return False
+        for node in [dw, pw]:
+            if 'BN' not in node.name or 'Relu' not in node.name or str(node.bias) != 'empty':
+                return False
+        # the depthwise output only lives in L1: no other layer can read it
+        return consumers(PULP_Nodes_Graph, dw.output_index) == [PULP_Nodes_Graph.index(pw)]
+
+    def fuse_layers(self, PULP_Nodes_Graph, number_of_deployed_layers, check_layer, L1_dimension, l2_buffer_size, BitActivation, optional, sdk, dma_parallelization):
+        # Depth-first fusion of depthwise + pointwise pairs (MobileNet blocks): the pair becomes a single node,
+        # executed by layer_template_fused.c, with the pointwise node stored in node.fused.
+        # A pair is fused only if the cost model predicts the fused row tiling faster than the two layers alone.
+        # The fused layer never uses L3 tiling, so its activations and weights must fit in half of the L2 buffer.
+        import copy
+        fused_graph = []
+        layer_index = []
+        i = 0
+        while i < len(PULP_Nodes_Graph):
+            node = PULP_Nodes_Graph[i]
+            if i + 1 < number_of_deployed_layers and self.fusable(node, PULP_Nodes_Graph[i + 1], optional, PULP_Nodes_Graph):
+                pw = PULP_Nodes_Graph[i + 1]
+                l2_occupation = (node.input_channels * node.groups * node.input_h * node.input_w + pw.output_channels * pw.output_h * pw.output_w
+                                 + node.groups * node.filter_size_h * node.filter_size_w + pw.input_channels * pw.output_channels)
+                tile_gen = Tiling('Fused',
+                                  pw.output_channels,
+                                  [node.filter_size_h, node.filter_size_w],
+                                  node.stride,
+                                  [node.padding_top, node.padding_left, node.padding_bottom, node.padding_right],
+                                  node.groups,
+                                  [node.input_channels * node.groups, node.input_h, node.input_w],
+                                  L1_dimension,
+                                  l2_buffer_size,
+                                  self.platform,
+                                  self.chip,
+                                  test_location='L3',
+                                  BitIn=8,
+                                  BitW=8,
+                                  BitOut=8,
+                                  BitActivation = BitActivation,
+                                  optional_type=optional,
+                                  sdk = sdk,
+                                  dma_parallelization = dma_parallelization,
+                                  cost_model = self.cost_model)
+                fused = tile_gen.get_tiling_fused_dw_pw_like(pw.output_channels, 1)
+                unfused = tile_gen.get_tiling_unfused_dw_pw_like(pw.output_channels, 1)
+                logging.debug("  Fusion of layers " + str(i) + " and " + str(i + 1) + ": " +
+                              "fused cycles: " + (str(fused[2]) if fused is not None else "not feasible").ljust(15) +
+                              "unfused cycles: " + (str(unfused) if unfused is not None else "not feasible").ljust(15) +
+                              "L2: " + str(l2_occupation) + " B")
+                if fused is not None and unfused is not None and fused[2] < unfused and l2_occupation <= l2_buffer_size / 2:
+                    new_node = copy.copy(node)
+                    new_node.name = 'Fused' + node.name + pw.name
+                    new_node.fused = pw
+                    new_node.output_channels = pw.output_channels
+                    new_node.output_h = pw.output_h
+                    new_node.output_w = pw.output_w
+                    new_node.output_index = pw.output_index
+                    new_node.MACs = node.MACs + pw.MACs
+                    fused_graph.append(new_node)
+                    layer_index.append(i + 1)
+                    i += 2
+                    continue
+            fused_graph.append(node)
+            layer_index.append(i)
+            i += 1
+        number_of_fused_layers = len([index for index in layer_index if index < number_of_deployed_layers])
+        if check_layer != 100:
+            check_layer = [j for j, index in enumerate(layer_index) if index >= check_layer][0]
+        print("Layer fusion: " + str(len(PULP_Nodes_Graph) - len(fused_graph)) + " depthwise + pointwise pairs fused")
+        return fused_graph, number_of_fused_layers, check_layer
+
+    def create_node_weights(self, nodes_to_deploy, BitActivation, precision_weights):
+        # weights, bias, k and lambda of a node, as a list of bytes. k and lambda already include the out_mult.
+        weights = []
+        if str(nodes_to_deploy.weights) != 'empty':
+            nodes_to_deploy.weights = nodes_to_deploy.weights.flatten().tolist()
+            for i_w, _ in enumerate(nodes_to_deploy.weights):
+                nodes_to_deploy.weights[i_w] = np.uint8(nodes_to_deploy.weights[i_w])
+            if precision_weights == 4:
+                temp = []
+                z = 0
+                for _, i_x in enumerate(nodes_to_deploy.weights):
+                    if (z % 2) == 0:
+                        temp.append(nodes_to_deploy.weights[i_w]& 0x0F)
+                    else:
+                        temp[-1] += i_x << 4
+                    z += 1
+                nodes_to_deploy.weights = temp
+            elif precision_weights == 2:
+                temp = []
+                z = 0
+                for _, i_x in enumerate(nodes_to_deploy.weights):
+                    if (z % 4) == 0:
+                        temp.append(nodes_to_deploy.weights[i_w]& 0x03)
+                    else:
+                        temp[-1] += i_x << 2 * (z % 4)
+                    z += 1
+                nodes_to_deploy.weights = temp
+            weights = nodes_to_deploy.weights
+        if str(nodes_to_deploy.bias) != 'empty':
+            nodes_to_deploy.bias = nodes_to_deploy.bias.flatten().tolist()
+            for i_w, _ in enumerate(nodes_to_deploy.bias):
+                nodes_to_deploy.bias[i_w] = np.uint8(nodes_to_deploy.bias[i_w])
+            weights = np.concatenate((weights, nodes_to_deploy.bias))
+        if str(nodes_to_deploy.k) != 'empty':
+            if str(nodes_to_deploy.outmul) != 'empty':
+                out_mult = np.int32(nodes_to_deploy.outmul)
+            k_byte = []
+            for i_k, _ in enumerate(nodes_to_deploy.k.flatten()):
+                if BitActivation == 64:
+                    val = np.int64(nodes_to_deploy.k.flatten()[i_k])*out_mult
+                else:
+                    val = np.int32(nodes_to_deploy.k.flatten()[i_k])*out_mult
+                if BitActivation == 32:
+                    k_byte.append(np.uint8(val         & 0x000000FF))
+                    k_byte.append(np.uint8((val >> 8)  & 0x000000FF))
+                    k_byte.append(np.uint8((val >> 16) & 0x000000FF))
+                    k_byte.append(np.uint8((val >> 24) & 0x000000FF))
+                if BitActivation == 64:
+                    k_byte.append(np.uint8(val         & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 8)  & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 16) & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 24) & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 32) & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 40) & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 48) & 0x00000000000000FF))
+                    k_byte.append(np.uint8((val >> 56) & 0x00000000000000FF))
+            nodes_to_deploy.k = k_byte
+
+            weights = np.concatenate((weights, nodes_to_deploy.k))
+        if str(nodes_to_deploy.lambd) != 'empty':
+            lambd = np.float64(nodes_to_deploy.lambd.flatten()) * out_mult
+            try:
+                lambd.shape[0]
+            except:
+                lambd = np.asarray([np.float64(nodes_to_deploy.lambd.flatten()) * out_mult])
+            lambd_byte = []
+            for i_l, _ in enumerate(nodes_to_deploy.lambd.flatten()):
+                if BitActivation == 64:
+                    val = np.int64(lambd[i_l])
+                else:
+                    val = np.int32(lambd[i_l])
+                if BitActivation == 32:
+                    lambd_byte.append(np.uint8(val &         0x000000FF))
+                    lambd_byte.append(np.uint8((val >> 8) &  0x000000FF))
+                    lambd_byte.append(np.uint8((val >> 16) & 0x000000FF))
+                    lambd_byte.append(np.uint8((val >> 24) & 0x000000FF))
+                if BitActivation == 64:
+                    lambd_byte.append(np.uint8(val &         0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 8) &  0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 16) & 0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 24) & 0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 32) & 0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 40) & 0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 48) & 0x00000000000000FF))
+                    lambd_byte.append(np.uint8((val >> 56) & 0x00000000000000FF))
+            nodes_to_deploy.lambd = lambd_byte
+            weights = np.concatenate((weights, nodes_to_deploy.lambd))
+            if str(nodes_to_deploy.outmul) != 'empty':
+                nodes_to_deploy.outmul = 1
+        return weights
+
     def create_weights_files(self, PULP_Nodes_Graph, number_of_deployed_layers, BitActivation, precision_dict_weights):
         ####################################################################################
         ###### SECTION 2: WEIGHTS FILES CREATION. CREATING .HEX FILES FOR EACH LAYER  ######
@@ -180,104 +373,84 @@ class Model_deployment():
         # 32 bits and 64 bits for Bn and Relu weights are used
         weights_to_write = []
         for i, nodes_to_deploy in enumerate(PULP_Nodes_Graph[:number_of_deployed_layers]):
-            if str(nodes_to_deploy.weights) != 'empty':
-                nodes_to_deploy.weights = nodes_to_deploy.weights.flatten().tolist()
-                for i_w, _ in enumerate(nodes_to_deploy.weights):
-                    nodes_to_deploy.weights[i_w] = np.uint8(nodes_to_deploy.weights[i_w])
-                if precision_dict_weights[i] == 4:
-                    temp = []
-                    z = 0
-                    for _, i_x in enumerate(nodes_to_deploy.weights):
-                        if (z % 2) == 0:
-                            temp.append(nodes_to_deploy.weights[i_w]& 0x0F)
-                        else:
-                            temp[-1] += i_x << 4
-                        z += 1
-                    nodes_to_deploy.weights = temp
-                elif precision_dict_weights[i] == 2:
-                    temp = []
-                    z = 0
-                    for _, i_x in enumerate(nodes_to_deploy.weights):
-                        if (z % 4) == 0:
-                            temp.append(nodes_to_deploy.weights[i_w]& 0x03)
-                        else:
-                            temp[-1] += i_x << 2 * (z % 4)
-                        z += 1
-                    nodes_to_deploy.weights = temp
-                weights = nodes_to_deploy.weights
-            if str(nodes_to_deploy.bias) != 'empty':
-                nodes_to_deploy.bias = nodes_to_deploy.bias.flatten().tolist()
-                for i_w, _ in enumerate(nodes_to_deploy.bias):
-                    nodes_to_deploy.bias[i_w] = np.uint8(nodes_to_deploy.bias[i_w])
-                weights = np.concatenate((weights, nodes_to_deploy.bias))
-            if str(nodes_to_deploy.k) != 'empty':
-                if str(nodes_to_deploy.outmul) != 'empty':
-                    out_mult = np.int32(nodes_to_deploy.outmul)
-                k_byte = []
-                for i_k, _ in enumerate(nodes_to_deploy.k.flatten()):
-                    if BitActivation == 64:
-                        val = np.int64(nodes_to_deploy.k.flatten()[i_k])*out_mult
-                    else:
-                        val = np.int32(nodes_to_deploy.k.flatten()[i_k])*out_mult
-                    if BitActivation == 32:
-                        k_byte.append(np.uint8(val         & 0x000000FF))
-                        k_byte.append(np.uint8((val >> 8)  & 0x000000FF))
-                        k_byte.append(np.uint8((val >> 16) & 0x000000FF))
-                        k_byte.append(np.uint8((val >> 24) & 0x000000FF))
-                    if BitActivation == 64:
-                        k_byte.append(np.uint8(val         & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 8)  & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 16) & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 24) & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 32) & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 40) & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 48) & 0x00000000000000FF))
-                        k_byte.append(np.uint8((val >> 56) & 0x00000000000000FF))
-                nodes_to_deploy.k = k_byte
-
-                weights = np.concatenate((weights, nodes_to_deploy.k))
-            if str(nodes_to_deploy.lambd) != 'empty':
-                lambd = np.float64(nodes_to_deploy.lambd.flatten()) * out_mult
-                try:
-                    lambd.shape[0]
-                except:
-                    lambd = np.asarray([np.float64(nodes_to_deploy.lambd.flatten()) * out_mult])
-                lambd_byte = []
-                for i_l, _ in enumerate(nodes_to_deploy.lambd.flatten()):
-                    if BitActivation == 64:
-                        val = np.int64(lambd[i_l])
-                    else:
-                        val = np.int32(lambd[i_l])
-                    if BitActivation == 32:
-                        lambd_byte.append(np.uint8(val &         0x000000FF))
-                        lambd_byte.append(np.uint8((val >> 8) &  0x000000FF))
-                        lambd_byte.append(np.uint8((val >> 16) & 0x000000FF))
-                        lambd_byte.append(np.uint8((val >> 24) & 0x000000FF))
-                    if BitActivation == 64:
-                        lambd_byte.append(np.uint8(val &         0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 8) &  0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 16) & 0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 24) & 0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 32) & 0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 40) & 0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 48) & 0x00000000000000FF))
-                        lambd_byte.append(np.uint8((val >> 56) & 0x00000000000000FF))
-                nodes_to_deploy.lambd = lambd_byte
-                weights = np.concatenate((weights, nodes_to_deploy.lambd))
-                if str(nodes_to_deploy.outmul) != 'empty':
-                    PULP_Nodes_Graph[i].outmul = 1
-            if str(nodes_to_deploy.weights) != 'empty':
+            weights = self.create_node_weights(nodes_to_deploy, BitActivation, precision_dict_weights[i])
+            if str(nodes_to_deploy.weights) == 'empty':
+                continue
+            if str(nodes_to_deploy.fused) != 'empty':
+                # fused layer: pointwise weights after the depthwise ones, both aligned to 4 bytes
                 while len(weights) % 4 != 0:
                     weights = np.concatenate((weights, np.asarray([0])))
-                weights = np.asarray(weights)
-                weights_to_write.append(weights)
-                string_layer = nodes_to_deploy.name + str(i) + "_weights.hex"
-                file_list_w.append(string_layer)
-                save_s = './application/DORY_network/' + string_layer
+                weights = np.concatenate((weights, self.create_node_weights(nodes_to_deploy.fused, BitActivation, precision_dict_weights[i])))
+            while len(weights) % 4 != 0:
+                weights = np.concatenate((weights, np.asarray([0])))
+            weights = np.asarray(weights)
+            weights_to_write.append(weights)
+            string_layer = nodes_to_deploy.name + str(i) + "_weights.hex"
+            file_list_w.append(string_layer)
+            save_s = './application/DORY_network/' + string_layer
+            with open(save_s, 'wb') as f:
+                for l in weights.astype('uint8').flatten():
+                    f.write(bytes((l,)))
+        return PULP_Nodes_Graph, file_list_w, weights_to_write
+
+    def tile_major_weights(self, PULP_Nodes_Graph, number_of_deployed_layers, file_list_w, weights_to_write):
+        # Weights tiled from L3 are read one output channel tile at a time by layer_template_L3.c.
+        # Weights, bias, k and lambda of each tile are rewritten one after the other, in the order of the tiles:
+        # each tile is then a single HyperRAM read, already in the layout of the L2 layer (weights, bias, k, lambda).
+        f_w = 0
+        for i, nodes_to_deploy in enumerate(PULP_Nodes_Graph[:number_of_deployed_layers]):
+            if str(nodes_to_deploy.weights) == 'empty':
+                continue
+            if nodes_to_deploy.weights_tiles > 1:
+                weights = weights_to_write[f_w]
+                tiles = nodes_to_deploy.weights_tiles
+                parts = []
+                start = 0
+                for field in [nodes_to_deploy.weights, nodes_to_deploy.bias, nodes_to_deploy.k, nodes_to_deploy.lambd]:
+                    size = len(field) if str(field) != 'empty' else 0
+                    if size % tiles != 0:
+                        print("Layer " + str(i) + ": " + str(size) + " bytes of parameters not divisible in " + str(tiles) + " L3 tiles. Exiting...")
+                        os._exit(0)
+                    parts.append(weights[start:start + size].reshape(tiles, -1))
+                    start += size
+                weights = np.concatenate([np.concatenate([part[t] for part in parts]) for t in range(tiles)] + [weights[start:]])
+                weights_to_write[f_w] = weights
+                save_s = './application/DORY_network/' + file_list_w[f_w]
                 with open(save_s, 'wb') as f:
                     for l in weights.astype('uint8').flatten():
                         f.write(bytes((l,)))
-        return PULP_Nodes_Graph, file_list_w, weights_to_write
+            f_w += 1
+        return weights_to_write
+
+    def run_tiling_jobs(self, jobs, tiling_processes):
+        # tilers of all the layers executed by a pool of tiling_processes processes (0: one per host core).
+        # The results are collected in the layer order by collect_tiling_job.
+        if tiling_processes == 0:
+            tiling_processes = os.cpu_count()
+        try:
+            with concurrent.futures.ProcessPoolExecutor(max_workers=tiling_processes, mp_context=multiprocessing.get_context('fork')) as executor:
+                futures = [executor.submit(run_tiling_job, job['tile_gen'], job['kwargs']) for job in jobs]
+                results = [future.result() for future in futures]
+        except concurrent.futures.process.BrokenProcessPool:
+            print("Tiling: a worker process exited while tiling the layers. Exiting...")
+            os._exit(0)
+        # time and cache accesses are accounted also for the layers that are tiled again
+        for result in results:
+            for method in TILER_STATISTICS.keys():
+                TILER_STATISTICS[method][0] += result['statistics'][method][0]
+                TILER_STATISTICS[method][1] += result['statistics'][method][1]
+            if self.tiling_cache is not None:
+                self.tiling_cache.hits += result['cache'][0]
+                self.tiling_cache.misses += result['cache'][1]
+        return results
+
+    def collect_tiling_job(self, result):
+        # log and exploration points of a layer tiled by a worker process, in the position of the layer
+        for message in result['log']:
+            logging.debug(message)
+        if self.tiling_exploration is not None:
+            self.tiling_exploration.layers.extend(result['exploration'])
+        return result['tiling']
 
     def create_layers_tiling(self, PULP_Nodes_Graph,
                             number_of_deployed_layers,
@@ -292,10 +465,33 @@ class Model_deployment():
                             precision_dict_act,
                             precision_dict_weights,
                             sdk,
-                            dma_parallelization):
+                            dma_parallelization,
+                            tiling_mode = 'layer',
+                            tiling_processes = 1):
         ####################################################################################
         ###### SECTION 3: PARSING OF EACH LAYER INDEPENDENT. TILING + LAYER CREATION  ######
         ####################################################################################
+        # with a network tiling mode, the L2 reserved for the weights of the next layer is planned jointly
+        # for all the layers before tiling them, instead of the layer by layer rule below.
+        network_plan = None
+        if tiling_mode != 'layer':
+            bits = []
+            BitIn_plan, BitW_plan, BitOut_plan = BitIn, BitW, BitOut
+            for i, nodes_to_deploy in enumerate(PULP_Nodes_Graph[:number_of_deployed_layers]):
+                if(optional != '8bit' and optional != '1D_Conv'):
+                    BitIn_plan = BitOut_plan
+                    if nodes_to_deploy.outshift != 'empty':
+                        BitOut_plan = precision_dict_act[i]
+                    BitW_plan = precision_dict_weights[i]
+                if i == len(PULP_Nodes_Graph)-1:
+                    BitOut_plan = 32
+                bits.append((BitIn_plan, BitW_plan, BitOut_plan))
+            network_plan = Network_tiling(self.cost_model,
+                                          l2_buffer_size,
+                                          BitActivation,
+                                          objective = 'L2' if tiling_mode == 'network-L2' else 'latency').plan(PULP_Nodes_Graph[:number_of_deployed_layers], bits)
+            if network_plan is None:
+                os._exit(0)
         name_list = []
         layer_list = []
         stringa_features = []
@@ -308,8 +504,17 @@ class Model_deployment():
         Layers_L3_weights = 0
         L2_memory_occupation = 0
         factor_h_out = 1
+        # phase 1: L2 budget, precisions and arguments of the tiler of each layer.
+        # Only the L3 tiling of the input activation depends on the tiling of the previous layer: it is decided in phase 3.
+        jobs = []
+        weight_constraint = 0
+        # activations kept in L2 across a layer without being read by it (residual bypasses) reduce its L2 budget
+        lifetimes = tensor_lifetimes(PULP_Nodes_Graph[:number_of_deployed_layers])
+        activation_bytes = {-1: int(PULP_Nodes_Graph[0].input_channels * PULP_Nodes_Graph[0].groups * PULP_Nodes_Graph[0].input_h * PULP_Nodes_Graph[0].input_w * BitIn / 8)}
         for i, nodes_to_deploy in enumerate(PULP_Nodes_Graph[:number_of_deployed_layers]):
-            if('Conv1D' in nodes_to_deploy.name):
+            if('Fused' in nodes_to_deploy.name):
+                layer = 'Fused'
+            elif('Conv1D' in nodes_to_deploy.name):
                 layer = 'Conv1D'
             elif('Conv' in nodes_to_deploy.name or 'Gemm' in nodes_to_deploy.name or 'MatMul' in nodes_to_deploy.name):
                 layer = 'Conv'
@@ -323,7 +528,15 @@ class Model_deployment():
             #### OTHERWISE ONLY WEIGHT < L2/2 GO in L2 --> much more L3 tiling not needed############
             #########################################################################################
             tile_factor = 2
-            if (i < len(PULP_Nodes_Graph)-1) and ('Conv' in PULP_Nodes_Graph[i+1].name or 'Gemm' in PULP_Nodes_Graph[i+1].name or 'MatMul' in PULP_Nodes_Graph[i+1].name):
+            if network_plan is not None:
+                weight_overhead, next_weights_tiled = network_plan[i]
+            elif (i < len(PULP_Nodes_Graph)-1) and 'Fused' in PULP_Nodes_Graph[i+1].name:
+                # depthwise and pointwise weights of a fused layer, sized as 8 bits elements as below
+                if weights_bytes(PULP_Nodes_Graph[i+1], 8, 0) > int(l2_buffer_size/tile_factor):
+                    weight_overhead = int(l2_buffer_size/tile_factor)
+                else:
+                    weight_overhead = weights_bytes(PULP_Nodes_Graph[i+1], 8, BitActivation)
+            elif (i < len(PULP_Nodes_Graph)-1) and has_weights(PULP_Nodes_Graph[i+1]):
                 if PULP_Nodes_Graph[i+1].input_channels*PULP_Nodes_Graph[i+1].output_channels*PULP_Nodes_Graph[i+1].filter_size_h*PULP_Nodes_Graph[i+1].filter_size_w > int(l2_buffer_size/tile_factor):
                     weight_overhead = int(l2_buffer_size/tile_factor)
                 else:
@@ -338,6 +551,11 @@ class Model_deployment():
             if i == len(PULP_Nodes_Graph)-1:
                 name_layer = name_layer + '_last'
                 BitOut = 32
+            activation_bytes[i] = int(nodes_to_deploy.output_channels * nodes_to_deploy.output_h * nodes_to_deploy.output_w * BitOut / 8)
+            bypass_bytes = sum([activation_bytes[j] for j in live_across(PULP_Nodes_Graph[:number_of_deployed_layers], lifetimes, i)])
+            if bypass_bytes > 0:
+                logging.debug("  Layer " + str(i) + ": " + str(bypass_bytes) + " bytes of L2 kept for bypassed activations")
+            l2_budget = l2_buffer_size - weight_overhead - bypass_bytes
             if(performance_single_layer == 'Yes'):
                 test_location = 'L3+performance'
             else:
@@ -351,7 +569,7 @@ class Model_deployment():
                               [nodes_to_deploy.input_channels * nodes_to_deploy.groups,
                               nodes_to_deploy.input_h, nodes_to_deploy.input_w],
                               L1_dimension,
-                              l2_buffer_size-weight_overhead,
+                              l2_budget,
                               self.platform,
                               self.chip,
                               test_location=test_location,
@@ -361,7 +579,11 @@ class Model_deployment():
                               BitActivation = BitActivation,
                               optional_type=optional,
                               sdk = sdk,
-                              dma_parallelization = dma_parallelization)
+                              dma_parallelization = dma_parallelization,
+                              cache = self.tiling_cache,
+                              cost_model = self.cost_model,
+                              exploration = self.tiling_exploration,
+                              cp_baseline = self.cp_baseline)
             if(nodes_to_deploy.conv_1d == 0):
                 str_l = 'ch_in' + str(nodes_to_deploy.input_channels) + 'ch_out' + str(nodes_to_deploy.output_channels) + 'groups' + str(
                     nodes_to_deploy.groups) + 'dim_image' + str(nodes_to_deploy.input_h,) + str(nodes_to_deploy.input_w,) + 'stride' + str(nodes_to_deploy.stride) + 'kernel'+ str(
@@ -383,59 +605,134 @@ class Model_deployment():
             relu = 0
             BN = 0
             DW = 0
+            if('Relu' in nodes_to_deploy.name):
+                relu = 1
+            if('BN' in nodes_to_deploy.name):
+                BN = 1
+            if('DW' in nodes_to_deploy.name):
+                DW = 1
+            if nodes_to_deploy.bias == 'empty':
+                h_b = 0
+            else:
+                h_b = 1
+            if('Conv1D' in nodes_to_deploy.name):
+                kwargs = dict(X=0, Y=0, W=0,
+                              relu=relu, BN=BN,
+                              dilation=nodes_to_deploy.dilation,
+                              has_bias=h_b,
+                              out_mul=nodes_to_deploy.outmul,
+                              out_shift=nodes_to_deploy.outshift,
+                              name=name_layer)
+            elif('Fused' in nodes_to_deploy.name):
+                kwargs = dict(X=0, Y=0, W=0,
+                              relu=relu, BN=BN,
+                              pw_out_ch=nodes_to_deploy.output_channels,
+                              out_mul=nodes_to_deploy.outmul,
+                              out_shift=nodes_to_deploy.outshift,
+                              pw_out_mul=nodes_to_deploy.fused.outmul,
+                              pw_out_shift=nodes_to_deploy.fused.outshift,
+                              name=name_layer)
+            elif('Gemm' in nodes_to_deploy.name or 'Conv' in nodes_to_deploy.name or 'MatMul' in nodes_to_deploy.name):
+                kwargs = dict(X=0, Y=0, W=0,
+                              relu=relu, BN=BN, DW=DW,
+                              has_bias=h_b,
+                              out_mul=nodes_to_deploy.outmul,
+                              out_shift=nodes_to_deploy.outshift,
+                              name=name_layer,
+                              input_L3 = 0,
+                              input_dim_constraint = 0,
+                              output_weights_dim_constraint = 0,
+                              weight_constraint = weight_constraint)
+            elif('Pool' in nodes_to_deploy.name):
+                kwargs = dict(X=0, Y=0, W=0,
+                              relu=relu, BN = BN,
+                              out_mul=nodes_to_deploy.outmul,
+                              out_shift=nodes_to_deploy.outshift,
+                              name=name_layer,
+                              input_L3 = 0,
+                              input_dim_constraint = 0,
+                              output_weights_dim_constraint = 0,
+                              type=name)
+            elif('Add' in nodes_to_deploy.name):
+                kwargs = dict(X=0, Y=0, W=0,
+                              relu=relu,
+                              out_mul1=nodes_to_deploy.inmul1,
+                              out_mul2=nodes_to_deploy.inmul2,
+                              out_shift=nodes_to_deploy.outshift,
+                              name=name_layer,
+                              type=name,
+                              inplace=int(last_read(PULP_Nodes_Graph[:number_of_deployed_layers], lifetimes, i) is not None))
+            jobs.append({'tile_gen': tile_gen, 'kwargs': kwargs, 'name_layer': name_layer,
+                         'l2_budget': l2_budget, 'BitIn': BitIn, 'BitOut': BitOut})
+            if network_plan is not None:
+                weight_constraint = int(l2_buffer_size/2) if next_weights_tiled else 0
+            elif(weight_overhead == int(l2_buffer_size/2)):
+                weight_constraint = int(l2_buffer_size/2)
+            else:
+                weight_constraint = 0
+        # phase 2: the tilers of all the layers, including the generation of their files, run in parallel
+        # assuming that no input activation is tiled from L3. Layers for which this is not true are redone in phase 3.
+        speculative = [None] * len(jobs)
+        if tiling_processes != 1 and len(jobs) > 1:
+            speculative = self.run_tiling_jobs(jobs, tiling_processes)
+        # identical layers share the same file: the last one is generated again in order, as in a sequential run
+        last_job = {}
+        for i, job in enumerate(jobs):
+            last_job[job['name_layer']] = i
+        shared_names = set(job['name_layer'] for i, job in enumerate(jobs) if last_job[job['name_layer']] != i)
+        # phase 3: in the order of the layers, L3 tiling of the input activation and collection of the results
+        weights_dim = 0
+        for i, nodes_to_deploy in enumerate(PULP_Nodes_Graph[:number_of_deployed_layers]):
+            job = jobs[i]
+            tile_gen = job['tile_gen']
+            name_layer = job['name_layer']
+            l2_budget = job['l2_budget']
+            BitIn = job['BitIn']
+            BitOut = job['BitOut']
             input_dim_constraint = 0
             output_weights_dim_constraint = 0
-            if(i == 0):
-                weight_constraint = 0
             if(i == 0):
                 input_L3 = 0
             elif(factor_h_out > 1):
                 input_L3 = 1
                 input_dim_constraint = out_dim2
-                output_weights_dim_constraint = l2_buffer_size - weight_overhead - out_dim2_old
+                output_weights_dim_constraint = l2_budget - out_dim2_old
                 if(output_weights_dim_constraint < 0):
                     print("Problems with current implementation on L3 tiling. Prediction of weights of next layer not accurate. Exiting...")
                     os._exit(0)
             else:
                 input_L3 = 0
-            if('Relu' in nodes_to_deploy.name):
-                relu = 1
-            if('BN' in nodes_to_deploy.name):
-                BN = 1
-            if('DW' in nodes_to_deploy.name):
-                DW = 1
+            if 'input_L3' in job['kwargs']:
+                job['kwargs'].update(input_L3 = input_L3,
+                                     input_dim_constraint = input_dim_constraint,
+                                     output_weights_dim_constraint = output_weights_dim_constraint)
+            if('Fused' in nodes_to_deploy.name and input_L3 == 1):
+                print("Fused layer: input activation tiled from L3 not supported. Exiting...")
+                os._exit(0)
+            if speculative[i] is None or input_L3 == 1 or (name_layer in shared_names and last_job[name_layer] == i):
+                tile_gen.inplace_offset = None
+                tiling_result = tile_gen.get_tiling(**job['kwargs'])
+            else:
+                tiling_result = self.collect_tiling_job(speculative[i])
+                tile_gen.inplace_offset = speculative[i]['inplace_offset']
             if('Conv1D' in nodes_to_deploy.name):
-                if nodes_to_deploy.bias == 'empty':
-                    h_b = 0
-                else:
-                    h_b = 1
-                in_dim2, out_dim2, weights_dim, l1_dim2 = tile_gen.get_tiling(X=0, Y=0, W=0,
-                                                                            relu=relu, BN=BN,
-                                                                            dilation=nodes_to_deploy.dilation,
-                                                                            has_bias=h_b,
-                                                                            out_mul=nodes_to_deploy.outmul,
-                                                                            out_shift=nodes_to_deploy.outshift,
-                                                                            name=name_layer)
+                in_dim2, out_dim2, weights_dim, l1_dim2 = tiling_result
                 if(i == 0):
                     out_dim2_old = in_dim2
                 out_dim2_old = out_dim2
                 L3_tiling = 0
                 factor_ch_out = 1
+            elif('Fused' in nodes_to_deploy.name):
+                in_dim2, out_dim2, weights_dim, l1_dim2, L3_tiling, factor_ch_out, factor_h_out, factor_h_in = tiling_result
+                PULP_Nodes_Graph[i].L3_allocation = 0
+                PULP_Nodes_Graph[i].L3_input = 0
+                PULP_Nodes_Graph[i].L3_output = 0
+                PULP_Nodes_Graph[i].L3_weights = 0
+                if(i == 0):
+                    out_dim2_old = in_dim2
+                out_dim2_old = out_dim2
             elif('Gemm' in nodes_to_deploy.name or 'Conv' in nodes_to_deploy.name or 'MatMul' in nodes_to_deploy.name):
-                if nodes_to_deploy.bias == 'empty':
-                    h_b = 0
-                else:
-                    h_b = 1
-                in_dim2, out_dim2, weights_dim, l1_dim2, L3_tiling, factor_ch_out, factor_h_out, factor_h_in = tile_gen.get_tiling(X=0, Y=0, W=0,
-                                                                            relu=relu, BN=BN, DW=DW,
-                                                                            has_bias=h_b,
-                                                                            out_mul=nodes_to_deploy.outmul,
-                                                                            out_shift=nodes_to_deploy.outshift,
-                                                                            name=name_layer,
-                                                                            input_L3 = input_L3,
-                                                                            input_dim_constraint = input_dim_constraint,
-                                                                            output_weights_dim_constraint = output_weights_dim_constraint,
-                                                                            weight_constraint = weight_constraint)
+                in_dim2, out_dim2, weights_dim, l1_dim2, L3_tiling, factor_ch_out, factor_h_out, factor_h_in = tiling_result
                 if(factor_ch_out > 1):
                     PULP_Nodes_Graph[i].L3_allocation = 1
                 else:
@@ -446,44 +743,27 @@ class Model_deployment():
                 PULP_Nodes_Graph[i].L3_input = int(factor_h_in > 1)
                 PULP_Nodes_Graph[i].L3_output = int(factor_h_out > 1)
                 PULP_Nodes_Graph[i].L3_weights = int(factor_ch_out > 1)
+                PULP_Nodes_Graph[i].weights_tiles = int(factor_ch_out)
                 if(i == 0):
                     out_dim2_old = in_dim2
                 if(factor_h_out > 1):
-                    out_dim2 = l2_buffer_size - weight_overhead - out_dim2_old - weights_dim
+                    out_dim2 = l2_budget - out_dim2_old - weights_dim
                 out_dim2_old = out_dim2
             elif('Pool' in nodes_to_deploy.name):
-                in_dim2, out_dim2, l1_dim2, L3_tiling, factor_h_out, factor_h_in = tile_gen.get_tiling(X=0, Y=0, W=0,
-                                                                 relu=relu, BN = BN,
-                                                                 out_mul=nodes_to_deploy.outmul,
-                                                                 out_shift=nodes_to_deploy.outshift,
-                                                                 name=name_layer,
-                                                                 input_L3 = input_L3,
-                                                                 input_dim_constraint = input_dim_constraint,
-                                                                 output_weights_dim_constraint = output_weights_dim_constraint,
-                                                                 type=name)
+                in_dim2, out_dim2, l1_dim2, L3_tiling, factor_h_out, factor_h_in = tiling_result
                 Layers_L3_input_act += int(factor_h_in > 1)
                 Layers_L3_output_act += int(factor_h_out > 1)
                 if(i == 0):
                     out_dim2_old = in_dim2
                 if(factor_h_out > 1):
-                    out_dim2 = l2_buffer_size - weight_overhead - out_dim2_old - weights_dim
+                    out_dim2 = l2_budget - out_dim2_old - weights_dim
                 out_dim2_old = out_dim2
             elif('Add' in nodes_to_deploy.name):
-                in_dim2, out_dim2, l1_dim2 = tile_gen.get_tiling(X=0, Y=0, W=0,
-                                                                 relu=relu,
-                                                                 out_mul1=nodes_to_deploy.inmul1,
-                                                                 out_mul2=nodes_to_deploy.inmul2,
-                                                                 out_shift=nodes_to_deploy.outshift,
-                                                                 name=name_layer,
-                                                                 type=name)
+                in_dim2, out_dim2, l1_dim2 = tiling_result
                 L3_tiling = 0
 
             while weights_dim % 4 != 0:
                 weights_dim += 1
-            if(weight_overhead == int(l2_buffer_size/2)):
-                weight_constraint = int(l2_buffer_size/2)
-            else:
-                weight_constraint = 0
             if(L3_tiling == 1):
                 name_layer = name_layer + 'L3'
                 PULP_Nodes_Graph[i].input_activation_dimensions_L3 = int(PULP_Nodes_Graph[i].input_h * PULP_Nodes_Graph[i].input_w * PULP_Nodes_Graph[i].input_channels*BitIn/8)
@@ -515,6 +795,8 @@ class Model_deployment():
                 if(PULP_Nodes_Graph[i].input_activation_dimensions != PULP_Nodes_Graph[i-1].output_activation_dimensions):
                     PULP_Nodes_Graph[i].input_activation_dimensions = PULP_Nodes_Graph[i-1].output_activation_dimensions
             PULP_Nodes_Graph[i].l1_dimensions = l1_dim2
+            # the output can be written over the input, unless the activations are tiled from L3
+            PULP_Nodes_Graph[i].inplace_offset = tile_gen.inplace_offset if L3_tiling == 0 and input_L3 == 0 else None
             if('Pool' not in nodes_to_deploy.name):
                 MAC_total += nodes_to_deploy.MACs
         return PULP_Nodes_Graph, Layers_L3_input_act, Layers_L3_output_act, Layers_L3_weights, name_layer_list, name_list, MAC_total
@@ -545,8 +827,11 @@ class Model_deployment():
             for i in x_in.astype('uint8').flatten():
                 f.write(bytes((i,)))
         f_w = 0
+        # index of the out_layer file: a fused node produces the output of its pointwise layer
+        f_out = -1
         for f, nodes_to_deploy in enumerate(PULP_Nodes_Graph[:number_of_deployed_layers]):
-            X_in = pd.read_csv(load_dir + 'out_layer' + str(f) + '.txt')
+            f_out += 2 if str(nodes_to_deploy.fused) != 'empty' else 1
+            X_in = pd.read_csv(load_dir + 'out_layer' + str(f_out) + '.txt')
             X_in = X_in.values[:, 0].astype(int)
             if f == len(PULP_Nodes_Graph[:number_of_deployed_layers]) - 1:
                 class_out = np.where(X_in == np.max(X_in))[0][0]
@@ -574,8 +859,8 @@ class Model_deployment():
             PULP_Nodes_Graph[f].check_sum_out = sum(Input_compressed)
             if f == len(PULP_Nodes_Graph) - 1:
                 ww = np.asarray(nodes_to_deploy.weights).reshape(nodes_to_deploy.output_channels,nodes_to_deploy.input_channels ).astype(np.int8).astype(int)
-                X_in = pd.read_csv(load_dir + 'out_layer' + str(f-1) + '.txt')
-                X_out = pd.read_csv(load_dir + 'out_layer' + str(f) + '.txt')
+                X_in = pd.read_csv(load_dir + 'out_layer' + str(f_out-1) + '.txt')
+                X_out = pd.read_csv(load_dir + 'out_layer' + str(f_out) + '.txt')
                 X_in = X_in.values[:, 0].astype(int).reshape(X_in.shape[0],1)
                 try:
                     PULP_Nodes_Graph[f].check_sum_out = sum(sum(np.matmul(ww,X_in)))
@@ -608,12 +893,37 @@ class Model_deployment():
                             dma_parallelization='8-cores',
                             optional='8bit',
                             precision_dict_act = 'None',
-                            precision_dict_weights = 'None'):
+                            precision_dict_weights = 'None',
+                            tiling_cache_dir = None,
+                            cost_model_file = None,
+                            tiling_mode = 'layer',
+                            layer_fusion = 'No',
+                            tiling_exploration = 'No',
+                            tiler_baseline = 'No',
+                            tiling_processes = 1,
+                            weights_prefetch_depth = 3,
+                            weights_resident = 'No'):
         # Function used to create all the files for the application
+        # tiling solutions are reused from previous runs if tiling_cache_dir is not None (e.g. './tiling_cache/')
+        if tiling_cache_dir is not None:
+            self.tiling_cache = Tiling_cache(tiling_cache_dir)
+        # L2-L1 tiles minimize the cycles predicted by the cost model. Default coefficients if no calibration file is given
+        self.cost_model = Cost_model(cost_model_file)
+        # tiling_exploration: 'Yes' also writes the non-dominated L2-L1 tilings of each layer (L1, DMA commands, cycles)
+        # and a summary of the network cycles for each L1 budget in logs/Tiling_exploration*.csv/json
+        if tiling_exploration == 'Yes':
+            self.tiling_exploration = Tiling_exploration('./logs/')
+        # tiler_baseline: 'Yes' also solves with the CP model the layers tiled by enumeration, only to report the time saved
+        self.cp_baseline = tiler_baseline == 'Yes'
+        # tiling_processes: number of processes tiling the layers and generating their files in parallel, 0 for one per host core
+        # tiling_mode: 'layer' solves each layer with the L2 left by the previous one,
+        # 'network' plans the L2 of all layers jointly minimizing latency, 'network-L2' minimizing the peak L2 first
+        # weights_prefetch_depth: maximum number of layers ahead whose weights are read from L3 into L2 while the
+        # current layer runs. Reduced down to 1 (next layer only) if the prefetched weights do not fit in L2
+        # weights_resident: 'Yes' keeps in L2 across inferences the weights that save the most HyperRAM cycles
+        # in the L2 left free by the plan. They are read from L3 only once, by network_setup
         # copy backend is used to copy all the files of the backend
         self.copy_backend(optional, BitIn, BitW, BitOut, BitActivation, PULP_Nodes_Graph, number_of_deployed_layers, precision_dict_act, precision_dict_weights, sdk, dma_parallelization)
-        # create L3 files for weights. These files are .hex which are copied in hyperflash then
-        PULP_Nodes_Graph, weights_files_list, weights_to_write = self.create_weights_files(PULP_Nodes_Graph, number_of_deployed_layers, BitActivation, precision_dict_weights)
         fileh = logging.FileHandler('logs/Tiling_profiling.log', 'a')
         formatter = logging.Formatter('%(asctime)s - %(message)s')
         fileh.setFormatter(formatter)
@@ -623,6 +933,11 @@ class Model_deployment():
             log.removeHandler(hdlr)
         log.addHandler(fileh)
         print("Creating tiling profiling in Tiling_profling.log")
+        # layer_fusion: 'Yes' executes depthwise + pointwise pairs depth-first in L1 when the cost model predicts a gain
+        if layer_fusion == 'Yes':
+            PULP_Nodes_Graph, number_of_deployed_layers, check_layer = self.fuse_layers(PULP_Nodes_Graph, number_of_deployed_layers, check_layer, L1_dimension, l2_buffer_size, BitActivation, optional, sdk, dma_parallelization)
+        # create L3 files for weights. These files are .hex which are copied in hyperflash then
+        PULP_Nodes_Graph, weights_files_list, weights_to_write = self.create_weights_files(PULP_Nodes_Graph, number_of_deployed_layers, BitActivation, precision_dict_weights)
         # tiling of all the layers. Both tiling and layer generation
         PULP_Nodes_Graph, num_L3_input_tile, num_L3_output_tile, num_L3_weight_tile, name_layer_list, name_list, MAC_total = self.create_layers_tiling(PULP_Nodes_Graph,
             number_of_deployed_layers,
@@ -637,12 +952,26 @@ class Model_deployment():
             precision_dict_act,
             precision_dict_weights,
             sdk,
-            dma_parallelization)
+            dma_parallelization,
+            tiling_mode,
+            tiling_processes)
+        # weights files of the layers tiled from L3 in the order of their tiles
+        weights_to_write = self.tile_major_weights(PULP_Nodes_Graph, number_of_deployed_layers, weights_files_list, weights_to_write)
 
         logging.debug("  ")
         logging.debug("  Layers with L3 input activation: " + str(num_L3_input_tile))
         logging.debug("  Layers with L3 output activation: " + str(num_L3_output_tile))
         logging.debug("  Layers with L3 weights: " + str(num_L3_weight_tile))
+        # fixed L2 offsets of all the activations and weights, used by the network instead of a runtime allocator.
+        # The dronet network keeps twice the input at the beginning of L2 for the camera frame
+        input_size = int(PULP_Nodes_Graph[0].input_activation_dimensions * BitIn / 8.0 * (1 if optional == '1D_Conv' else 2))
+        l2_planner = L2_memory_planner(l2_buffer_size, BitW)
+        l2_peak = l2_planner.plan(PULP_Nodes_Graph[:number_of_deployed_layers], input_size, 1 if optional == '1D_Conv' else weights_prefetch_depth,
+                                  self.cost_model if weights_resident == 'Yes' and optional != '1D_Conv' else None)
+        # exact HyperRAM footprint: weights files, network input and the activations tiled to L3
+        l3_planner = L3_memory_planner(BitW)
+        l3_planner.plan(PULP_Nodes_Graph[:number_of_deployed_layers], sum([len(weights) for weights in weights_to_write]),
+                        int(PULP_Nodes_Graph[0].input_activation_dimensions * BitIn / 8.0))
 
         name_layer_list_unique = list(set(name_layer_list))
         for i, _ in enumerate(name_layer_list_unique):
@@ -701,6 +1030,11 @@ class Model_deployment():
             master_stack = master_stack,
             slave_stack = slave_stack,
             l2_buffer_size = l2_buffer_size,
+            l2_peak = l2_peak,
+            tensors = l2_planner.tensors,
+            prefetch_depth = l2_planner.prefetch_depth,
+            l3_weights_size = l3_planner.weights_size,
+            l3_activations_size = l3_planner.activations_size,
             fc_frequency = fc_frequency,
             cl_frequency = cl_frequency,
             MACs=MAC_total,
@@ -713,3 +1047,8 @@ class Model_deployment():
             optional_type = optional)
         # create the Makefile for the application
         template.print_template_Makefile(weights_files_list, self.platform, sdk)
+        print_tiler_statistics()
+        if self.tiling_cache is not None:
+            self.tiling_cache.print_statistics()
+        if self.tiling_exploration is not None:
+            self.tiling_exploration.write()
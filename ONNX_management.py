@@ -66,6 +66,8 @@ class node_element(nn.Module):
         self.L3_input = 0
         self.L3_output = 0
         self.L3_weights = 0
+        # number of output channel tiles of the weights read from L3 by layer_template_L3.c
+        self.weights_tiles = 1
         self.input_activation_dimensions = 0
         self.input_activation_dimensions_L3 = 0
         self.output_activation_dimensions = 0
@@ -83,6 +85,22 @@ class node_element(nn.Module):
         self.branch_change = 0
         self.conv_1d = 0
         self.dilation = 1
+        # pointwise node executed depth-first with this depthwise one (see Model_deployment.fuse_layers)
+        self.fused = 'empty'
+        # activations read and written by the layer, as indices of the tensor table of the network,
+        # and fixed offset of the weights in the L2 buffer (see memory_planning.L2_memory_planner)
+        self.input_tensor = 0
+        self.input_add_tensor = -1
+        self.output_tensor = 0
+        self.L2_weights_offset = 0
+        self.L2_extent = 0
+        # 1 if the weights are kept in L2 across inferences instead of being read from L3 by each of them
+        self.weights_resident = 0
+        # offsets of the activations tiled to L3 in the L3 activation buffer (see memory_planning.L3_memory_planner)
+        self.L3_input_offset = 0
+        self.L3_output_offset = 0
+        # distance of the output after the input in L2 if the layer can write it over its input, else None (see Tiling.inplace_output_offset)
+        self.inplace_offset = None
     def get_parameters(self):
         print('name: ' + self.name)
         print('filter: ' + str(self.input_channels) + 'x'+ str(self.filter_size_w) + 'x'+ str(self.filter_size_h) + 'x'+ str(self.output_channels))
@@ -495,7 +513,8 @@ class ONNX_management():
                         const = self.search_constant(index, model)
                         PULP_node = self.update_node(PULP_node, node_iterating.output[0], const, node_iterating.op_type)
                         break
-        # updating branch in/out connections
+        # updating branch in/out connections. These flags only drive the runtime allocator of the 1D network:
+        # the other networks are executed from the tensor table of memory_planning.L2_memory_planner
         for i, nodes in enumerate(PULP_Nodes_Graph):
             counter = 0
             for nodes_scan in PULP_Nodes_Graph:
@@ -0,0 +1,310 @@
+#
+# cost_model.py
+# Alessio Burrello <alessio.burrello@unibo.it>
+#
+# Copyright (C) 2019-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import json
+import os
+import re
+import numpy as np
+
+# Default coefficients, in cluster cycles. They can be overwritten by a calibration file,
+# a json dictionary with (a subset of) the same keys.
+# *_cycles_per_mac are per core: the MACs of a tile are first divided among the cores
+# in the same way the pulp-nn kernel parallelizes them.
+DEFAULT_COEFFICIENTS = {
+    'number_of_cores': 8,
+    'conv_overhead': 1200,
+    'conv_cycles_per_mac': 0.65,
+    'pointwise_overhead': 600,
+    'pointwise_cycles_per_mac': 0.55,
+    'depthwise_overhead': 900,
+    'depthwise_cycles_per_mac': 2.2,
+    'linear_overhead': 300,
+    'linear_cycles_per_mac': 0.6,
+    # for pooling and add layers a "mac" is one input element read by the kernel
+    'pooling_overhead': 500,
+    'pooling_cycles_per_mac': 0.4,
+    'add_overhead': 300,
+    'add_cycles_per_mac': 0.5,
+    # cost of programming one mchan_transfer (command queue writes) and of a blocking one (alloc + barrier)
+    'dma_cycles_per_command': 30,
+    'dma_cycles_per_blocking_command': 90,
+    'dma_cycles_per_byte': 0.125,
+    # transposition of the depthwise input tiles from HWC to CHW by the cores in L1 (dory_hwc_to_chw), per byte and core:
+    # with 32 bits accesses and shuffles if the channels of the tile are a multiple of 4, byte by byte otherwise
+    'hwc_to_chw_cycles_per_byte': 1.0,
+    'hwc_to_chw_scalar_cycles_per_byte': 4.0,
+    # barriers, double buffering offsets and tile sizes computed in each iteration of the tile loop
+    'tile_overhead': 350,
+    # barriers and descriptor table reads in each iteration of the tile loop of the conv layers,
+    # whose offsets and tile sizes are precomputed by template.py
+    'tile_table_overhead': 200,
+    # fraction of the DMA time hidden behind the kernel execution by the double-buffered loop
+    'double_buffering_overlap': 0.9,
+    # L3-L2 transfers with pi_cl_ram_read / pi_cl_ram_write
+    'hyperram_cycles_per_byte': 1.5,
+    'hyperram_cycles_per_read': 800
+}
+
+# Fixed point scale used to keep all the costs integer, as needed by the CP solver
+SCALE = 1000
+# Upper bound of the scaled cycles of a whole layer in the CP model (~10^12 cycles). The bounds of the products of
+# tile counts and per tile costs grow far beyond the real costs: they are clamped here, so that the final
+# multiplication by SCALE stays within int64.
+MAX_SCALED_CYCLES = 2 ** 50
+
+
+class Cost_model():
+    # Analytical model of the cycles spent by a layer_template.c layer.
+    # The same functions are used both with python integers, to evaluate a tiling,
+    # and with OR-tools expressions, to build the objective of the CP tiler (pass the solver).
+    def __init__(self, calibration_file=None):
+        self.coefficients = dict(DEFAULT_COEFFICIENTS)
+        if calibration_file is not None:
+            with open(calibration_file, 'r') as f:
+                calibration = json.load(f)
+            for key in calibration.keys():
+                if key not in self.coefficients:
+                    print("Cost model: unknown coefficient " + key + " in " + calibration_file + ". Exiting...")
+                    os._exit(0)
+            self.coefficients.update(calibration)
+
+    def __repr__(self):
+        # used also by the tiling cache: different coefficients give different tilings
+        return json.dumps(self.coefficients, sort_keys=True)
+
+    def save(self, calibration_file):
+        with open(calibration_file, 'w') as f:
+            json.dump(self.coefficients, f, indent=4, sort_keys=True)
+
+    def coefficient(self, key):
+        return int(round(self.coefficients[key] * SCALE))
+
+    def ceil_div(self, a, b, upper, solver=None):
+        # upper is an upper bound of the result, needed to create the CP variable
+        if solver is None:
+            return -(-a // b)
+        q = solver.IntVar(0, int(upper), 'ceil_div')
+        solver.Add(q * b >= a)
+        solver.Add((q - 1) * b <= a - 1)
+        return q
+
+    def bounded(self, expr, solver=None):
+        # expr as a CP variable with domain [0, MAX_SCALED_CYCLES]
+        if solver is None:
+            return expr
+        var = solver.IntVar(0, MAX_SCALED_CYCLES, 'scaled_cycles')
+        solver.Add(var == expr)
+        return var
+
+    def maximum(self, a, b, solver=None):
+        if solver is None:
+            return max(a, b)
+        return solver.Max(a, b)
+
+    def minimum(self, a, b, solver=None):
+        if solver is None:
+            return min(a, b)
+        return solver.Min(a, b)
+
+    def kernel_family(self, name, DW, fs1, fs2, stride):
+        # same selection of layer_template.c
+        if 'Pool' in name:
+            return 'pooling'
+        if 'Add' in name:
+            return 'add'
+        if DW == 1:
+            return 'depthwise'
+        if 'Gemm' in name or 'MatMul' in name:
+            return 'linear'
+        if fs1 * fs2 > 1 or stride > 1 or 'Relu0' in name:
+            return 'conv'
+        return 'pointwise'
+
+    def kernel_cycles(self, family, tile_n_in, tile_n_out, tile_h_out, tile_w_out, fs1, fs2, bounds, solver=None):
+        # scaled cycles of one execution of the kernel on a tile.
+        # bounds = (n_in, n_out, h_out, w_out) are the layer dimensions, used as upper bounds.
+        n_in, n_out, h_out, w_out = bounds
+        cores = self.coefficients['number_of_cores']
+        if family == 'conv':
+            # parallel on output rows, 4x2 (channels x pixels) register blocking
+            rows = self.ceil_div(tile_h_out, cores, h_out, solver)
+            pixels = self.ceil_div(tile_w_out, 2, w_out, solver) * 2
+            channels = self.ceil_div(tile_n_out, 4, n_out, solver) * 4
+            macs = rows * pixels * channels * tile_n_in * fs1 * fs2
+        elif family == 'pointwise':
+            # parallel on output pixels
+            pixels = self.ceil_div(tile_h_out * tile_w_out, cores, h_out * w_out, solver)
+            channels = self.ceil_div(tile_n_out, 4, n_out, solver) * 4
+            macs = pixels * channels * tile_n_in
+        elif family == 'depthwise':
+            # parallel on channels
+            channels = self.ceil_div(tile_n_out, cores, n_out, solver)
+            macs = channels * tile_h_out * tile_w_out * fs1 * fs2
+        else:
+            # parallel on output neurons
+            neurons = self.ceil_div(tile_n_out, cores, n_out, solver)
+            macs = neurons * tile_n_in
+        return self.coefficient(family + '_overhead') + self.coefficient(family + '_cycles_per_mac') * macs
+
+    def dma_cycles(self, commands, bits, blocking=False):
+        # scaled cycles of a group of mchan_transfer of a total of bits / 8 bytes
+        if blocking:
+            command_cost = self.coefficient('dma_cycles_per_blocking_command')
+        else:
+            command_cost = self.coefficient('dma_cycles_per_command')
+        return command_cost * commands + int(round(self.coefficients['dma_cycles_per_byte'] * SCALE / 8)) * bits
+
+    def conv_layer_cycles(self, family, DW, BN,
+                          n_in, n_out, h_in, h_out, w_out,
+                          tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                          fs1, fs2, BitIn, BitOut, BitW, BitActivation,
+                          multiple_buffering_factor=2, dma_parallelization='8-cores', solver=None, hwc_to_chw_L1=0):
+        # Predicted cycles of the L2-L1 tile loop of a convolution / linear layer, multiplied by SCALE * SCALE.
+        # Number of DMA commands follows the current dory.c implementation:
+        # one command per input row (per channel in DW, per channel and row in w tiled DW), one 2d command per output row, one per weight tile.
+        # hwc_to_chw_L1: the DW input tiles are copied in HWC and transposed by the cores (see Tiling.hwc_to_chw_layer).
+        bounds = (n_in, n_out, h_out, w_out)
+        cores = self.coefficients['number_of_cores'] if dma_parallelization == '8-cores' else 1
+        tiles_n_out = self.ceil_div(n_out, tile_n_out, n_out, solver)
+        tiles_h = self.ceil_div(h_out, tile_h_out, h_out, solver)
+        tiles_w = self.ceil_div(w_out, tile_w_out, w_out, solver)
+        if DW == 1:
+            tiles_n_in = 1
+        else:
+            tiles_n_in = self.ceil_div(n_in, tile_n_in, n_in, solver)
+        weight_loads = tiles_n_out * tiles_n_in
+        tiles = weight_loads * tiles_h * tiles_w
+        kernel = self.kernel_cycles(family, tile_n_in, tile_n_out, tile_h_out, tile_w_out, fs1, fs2, bounds, solver) + self.coefficient('tile_table_overhead')
+        if DW == 1 and hwc_to_chw_L1 == 1:
+            # one blocking 2d command per input row, then all the cores transpose the tile before the kernel
+            dma_x = self.dma_cycles(self.ceil_div(tile_h_in, cores, h_in, solver), BitIn * tile_n_in * tile_h_in * tile_w_in, blocking=True)
+            dma_W = self.dma_cycles(1, BitW * tile_n_out * fs1 * fs2, blocking=True)
+            # hwc_to_chw_L1 is only evaluated on python integers (Tiling.hwc_to_chw_layer)
+            per_byte = 'hwc_to_chw_cycles_per_byte' if tile_n_in % 4 == 0 else 'hwc_to_chw_scalar_cycles_per_byte'
+            kernel = kernel + self.coefficient(per_byte) * self.ceil_div(
+                tile_n_in * tile_h_in * tile_w_in * BitIn // 8, self.coefficients['number_of_cores'], n_in * h_in * tile_w_in, solver)
+        elif DW == 1:
+            # hwc to chw transposition, one blocking command per channel, or per channel and row if w is tiled
+            rows_per_channel = self.minimum(tiles_w - 1, 1, solver) * (tile_h_in - 1) + 1
+            dma_x = self.dma_cycles(self.ceil_div(tile_n_in, cores, n_in, solver) * rows_per_channel, BitIn * tile_n_in * tile_h_in * tile_w_in, blocking=True)
+            # the depthwise weight tile is contiguous in L2: one blocking command
+            dma_W = self.dma_cycles(1, BitW * tile_n_out * fs1 * fs2, blocking=True)
+        else:
+            dma_x = self.dma_cycles(self.ceil_div(tile_h_in, cores, h_in, solver), BitIn * tile_n_in * tile_h_in * tile_w_in)
+            dma_W = self.dma_cycles(1, BitW * tile_n_in * tile_n_out * fs1 * fs2)
+        if BN == 1:
+            dma_W = dma_W + self.dma_cycles(2, BitActivation * 2 * tile_n_out, blocking=True)
+        dma_y = self.dma_cycles(self.ceil_div(tile_h_out, cores, h_out, solver), BitOut * tile_n_out * tile_h_out * tile_w_out)
+        kernel_total = self.bounded(tiles * kernel, solver)
+        dma_total = self.bounded(tiles * (dma_x + dma_y) + weight_loads * dma_W, solver)
+        if multiple_buffering_factor > 1:
+            # each buffer beyond the second gives the DMA one more tile of slack: the exposed fraction shrinks geometrically
+            exposed = SCALE - self.coefficient('double_buffering_overlap')
+            overlap = SCALE - exposed ** (multiple_buffering_factor - 1) // SCALE ** (multiple_buffering_factor - 2)
+        else:
+            overlap = 0
+        # first input/weight transfer and last output write-back are never overlapped
+        return (SCALE * self.maximum(kernel_total, dma_total, solver) + (SCALE - overlap) * self.minimum(kernel_total, dma_total, solver)
+                + SCALE * (dma_x + dma_W + dma_y))
+
+    def conv_layer_dma_commands(self, DW, BN, n_in, n_out, h_out, w_out,
+                                tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_out, hwc_to_chw_L1=0):
+        # Total number of mchan_transfer programmed by the L2-L1 tile loop, counted as in conv_layer_cycles
+        # but summed over all the cores. Python integers only.
+        tiles_n_out = self.ceil_div(n_out, tile_n_out, n_out)
+        tiles_h = self.ceil_div(h_out, tile_h_out, h_out)
+        tiles_w = self.ceil_div(w_out, tile_w_out, w_out)
+        tiles_n_in = 1 if DW == 1 else self.ceil_div(n_in, tile_n_in, n_in)
+        weight_loads = tiles_n_out * tiles_n_in
+        tiles = weight_loads * tiles_h * tiles_w
+        if DW == 1 and hwc_to_chw_L1 == 0:
+            commands_x = tile_n_in * (min(tiles_w - 1, 1) * (tile_h_in - 1) + 1)
+        else:
+            commands_x = tile_h_in
+        # weight tiles are contiguous in L2, also for depthwise layers
+        commands_W = 1
+        if BN == 1:
+            commands_W += 2
+        commands_y = tile_h_out
+        return tiles * (commands_x + commands_y) + weight_loads * commands_W
+
+    def fused_dw_pw_cycles(self, n_in, n_out, h_in, h_out, w_out,
+                           tile_h_in, tile_w_in, tile_h_out,
+                           fs1, fs2, BitIn, BitOut, BitW, BitActivation,
+                           dma_parallelization='8-cores'):
+        # Predicted cycles of layer_template_fused.c, multiplied by SCALE * SCALE.
+        # Each row tile runs the depthwise and the pointwise kernel back to back on the L1 intermediate:
+        # only the input of the depthwise and the output of the pointwise are moved by the DMA.
+        cores = self.coefficients['number_of_cores'] if dma_parallelization == '8-cores' else 1
+        tiles = self.ceil_div(h_out, tile_h_out, h_out)
+        kernel = (self.kernel_cycles('depthwise', n_in, n_in, tile_h_out, w_out, fs1, fs2, (n_in, n_in, h_out, w_out))
+                  + self.kernel_cycles('pointwise', n_in, n_out, tile_h_out, w_out, 1, 1, (n_in, n_out, h_out, w_out))
+                  + 2 * self.coefficient('tile_overhead'))
+        dma_x = self.dma_cycles(self.ceil_div(n_in, cores, n_in), BitIn * n_in * tile_h_in * tile_w_in, blocking=True)
+        dma_y = self.dma_cycles(self.ceil_div(tile_h_out, cores, h_out), BitOut * n_out * tile_h_out * w_out)
+        # weights, k and lambda of both layers are loaded once
+        dma_W = self.dma_cycles(4, BitW * (n_in * fs1 * fs2 + n_in * n_out) + BitActivation * 2 * (n_in + n_out), blocking=True)
+        kernel_total = tiles * kernel
+        dma_total = tiles * (dma_x + dma_y)
+        overlap = self.coefficient('double_buffering_overlap') if tiles > 1 else 0
+        return (SCALE * max(kernel_total, dma_total) + (SCALE - overlap) * min(kernel_total, dma_total)
+                + SCALE * (dma_x + dma_y + dma_W))
+
+    def layer_compute_cycles(self, family, MACs):
+        # first order estimate of a whole layer, without knowing its tiling. Used by the network level planners.
+        return self.coefficients[family + '_overhead'] + self.coefficients[family + '_cycles_per_mac'] * MACs / self.coefficients['number_of_cores']
+
+    def hyperram_cycles(self, bytes_transferred):
+        return self.coefficients['hyperram_cycles_per_byte'] * bytes_transferred
+
+    def hyperram_read_cycles(self, bytes_transferred):
+        # one pi_cl_ram_read of a whole buffer, e.g. the weights of a layer
+        return self.coefficients['hyperram_cycles_per_read'] + self.hyperram_cycles(bytes_transferred)
+
+    def to_cycles(self, scaled_cycles):
+        return int(scaled_cycles / SCALE / SCALE)
+
+
+def parse_performance_log(log_file):
+    # reads the per-layer performance lines printed by network.c when performance_single_layer == 'Yes', e.g.
+    # [0] Layer 3  : num_cycles: 123456     , MACs: 1234567    , MAC/cycle: 10.000000, n. of Cores: 8
+    # and returns a dictionary {layer: (cycles, MACs)}
+    measures = {}
+    with open(log_file, 'r') as f:
+        for line in f:
+            match = re.search(r'Layer\s+(\d+)\s*:\s*num_cycles:\s*(\d+)\s*,\s*MACs:\s*(\d+)', line)
+            if match is not None:
+                measures[int(match.group(1))] = (int(match.group(2)), int(match.group(3)))
+    return measures
+
+
+def calibrate(cost_model, measures, families, calibration_file):
+    # least-squares fit of <family>_overhead and <family>_cycles_per_mac from measured layers.
+    # families is {layer: kernel family}; layers of a family are fitted as cycles = overhead + c * MACs / cores.
+    cores = cost_model.coefficients['number_of_cores']
+    for family in set(families.values()):
+        points = [measures[layer] for layer in measures.keys() if families.get(layer) == family]
+        if len(points) < 2:
+            continue
+        cycles = np.asarray([point[0] for point in points], dtype=float)
+        macs = np.asarray([point[1] for point in points], dtype=float) / cores
+        slope, intercept = np.polyfit(macs, cycles, 1)
+        cost_model.coefficients[family + '_cycles_per_mac'] = float(max(slope, 0.01))
+        cost_model.coefficients[family + '_overhead'] = float(max(intercept, 0))
+    cost_model.save(calibration_file)
+    return cost_model
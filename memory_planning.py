@@ -0,0 +1,325 @@
+#
+# memory_planning.py
+# Alessio Burrello <alessio.burrello@unibo.it>
+#
+# Copyright (C) 2019-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import logging
+import os
+import numpy as np
+
+L2_ALIGNMENT = 4
+
+
+def has_weights(node):
+    return 'Conv' in node.name or 'Gemm' in node.name or 'MatMul' in node.name
+
+
+def weights_bytes(node, BitW, BitActivation):
+    # bytes of weights, k and lambda of a layer. A fused layer stores the depthwise weights, k and lambda
+    # followed by the pointwise ones, each part aligned to 4 bytes (see create_weights_files).
+    def align(size):
+        return int(np.ceil(size / 4.0) * 4)
+    if 'Fused' in node.name:
+        dw = int(node.groups * node.filter_size_h * node.filter_size_w * BitW / 8) + int(node.groups * BitActivation / 8 * 2)
+        pw = int(node.fused.input_channels * node.fused.output_channels * BitW / 8) + int(node.fused.output_channels * BitActivation / 8 * 2)
+        return align(dw) + align(pw)
+    return int(node.input_channels * node.output_channels * node.filter_size_h * node.filter_size_w * BitW / 8) + int(node.output_channels * BitActivation / 8 * 2)
+
+
+def layer_inputs(node):
+    # names of the activations read by a layer: Add layers read two of them
+    if 'Add' in node.name:
+        return [node.input_index, node.input_index_add]
+    return [node.input_index]
+
+
+def tensor_lifetimes(PULP_Nodes_Graph):
+    # For each activation of the network (output of a layer, or network input with producer -1):
+    # index of the producer and of the last layer reading it. Outputs read by no layer live only in their layer.
+    producer = {}
+    for i, node in enumerate(PULP_Nodes_Graph):
+        producer[node.output_index] = i
+    last_use = {}
+    for name, i in producer.items():
+        last_use[name] = max(i, 0)
+    for i, node in enumerate(PULP_Nodes_Graph):
+        for name in layer_inputs(node):
+            if name not in producer:
+                producer[name] = -1
+            last_use[name] = max(last_use.get(name, 0), i)
+    # the output of the last layer is read back by the application after the network execution
+    last_use[PULP_Nodes_Graph[-1].output_index] = len(PULP_Nodes_Graph) - 1
+    return producer, last_use
+
+
+def consumers(PULP_Nodes_Graph, name):
+    # layers reading the activation name
+    return [i for i, node in enumerate(PULP_Nodes_Graph) if name in layer_inputs(node)]
+
+
+def check_graph(PULP_Nodes_Graph):
+    # The network is executed in the order of PULP_Nodes_Graph, that must be a topological order of the ONNX graph.
+    # Activations tiled to L3 are exchanged through the two L3 activation buffers of the network, swapped after
+    # each layer: they can only be read by the next layer. The output of the last layer is the output of the network.
+    producer = {}
+    for i, node in enumerate(PULP_Nodes_Graph):
+        producer[node.output_index] = i
+    for i, node in enumerate(PULP_Nodes_Graph):
+        for name in layer_inputs(node):
+            if producer.get(name, -1) >= i:
+                print("Layer " + str(i) + " reads the output of layer " + str(producer[name]) + ": graph not in topological order. Exiting...")
+                os._exit(0)
+        if node.L3_output == 1 and i < len(PULP_Nodes_Graph) - 1 and consumers(PULP_Nodes_Graph, node.output_index) != [i + 1]:
+            print("Layer " + str(i) + " has its output in L3, but it is not read only by the next layer. Exiting...")
+            os._exit(0)
+
+
+def live_across(PULP_Nodes_Graph, lifetimes, i):
+    # layers whose outputs stay in L2 during layer i without being read by it (e.g. the bypass of a residual block).
+    # They are not seen by the tiler of layer i, which only accounts for its own input, output and weights.
+    producer, last_use = lifetimes
+    inputs = layer_inputs(PULP_Nodes_Graph[i])
+    return [producer[name] for name in producer.keys()
+            if producer[name] < i and last_use[name] > i and name not in inputs]
+
+
+def last_read(PULP_Nodes_Graph, lifetimes, i):
+    # an input of layer i not read by any later layer, hence a buffer the output of layer i can be written over.
+    # For Add layers the output of the previous layer is preferred. None if all the inputs are read again later.
+    producer, last_use = lifetimes
+    inputs = layer_inputs(PULP_Nodes_Graph[i])
+    if len(inputs) == 2 and i > 0 and inputs[1] == PULP_Nodes_Graph[i-1].output_index:
+        inputs = [inputs[1], inputs[0]]
+    for name in inputs:
+        if last_use[name] == i and name != PULP_Nodes_Graph[i].output_index:
+            return name
+    return None
+
+
+class L2_memory_planner():
+    # Static planning of the L2 memory of the network, computed at generation time.
+    # Each activation and each weight buffer gets a fixed offset in the L2 buffer, so that the network
+    # does not allocate or free anything at runtime. Two buffers can share the same bytes only if their
+    # lifetimes (in layers) do not overlap:
+    # - activations live from their producer to the last layer reading them;
+    # - weights of layer i live from layer i-prefetch_depth to layer i, since they are prefetched from L3 while
+    #   the previous layers run. The deepest prefetch up to the requested one that fits the L2 budget is chosen.
+    # Layers that can write their output over an input read for the last time (node.inplace_offset, see
+    # Tiling.inplace_output_offset) share one buffer with it, the output starting inplace_offset bytes after the input.
+    # With a cost model, the L2 left free by the plan is filled with resident weights: weights loaded once by
+    # network_setup and kept for all the inferences, chosen by resident_weights.
+    # Offsets are assigned greedily, largest buffer first, at the lowest address free in its whole lifetime.
+    def __init__(self, l2_buffer_size, BitW=8):
+        self.l2_buffer_size = l2_buffer_size
+        self.BitW = BitW
+        # table of the activations of the network, filled by plan
+        self.tensors = []
+        self.prefetch_depth = 1
+        self.resident = []
+
+    def align(self, size):
+        return int((size + L2_ALIGNMENT - 1) / L2_ALIGNMENT) * L2_ALIGNMENT
+
+    def buffers(self, PULP_Nodes_Graph, input_size, prefetch_depth=1):
+        lifetimes = tensor_lifetimes(PULP_Nodes_Graph)
+        producer, last_use = lifetimes
+        # activations: each one is placed at 'position' bytes from the beginning of the buffer of its group
+        groups = {}
+        position = {}
+        for name, i in producer.items():
+            if i == -1:
+                groups[name] = {'name': 'input', 'tensors': [name], 'size': self.align(input_size), 'begin': 0, 'end': last_use[name], 'pinned': True}
+            else:
+                groups[name] = {'name': 'output' + str(i), 'tensors': [name], 'size': self.align(PULP_Nodes_Graph[i].output_activation_dimensions),
+                                'begin': i, 'end': last_use[name], 'pinned': False}
+            position[name] = 0
+        for i, node in enumerate(PULP_Nodes_Graph):
+            if getattr(node, 'inplace_offset', None) is None:
+                continue
+            name = last_read(PULP_Nodes_Graph, lifetimes, i)
+            if name is None:
+                continue
+            group = [g for g in groups.values() if name in g['tensors']][0]
+            output = groups.pop(node.output_index)
+            position[node.output_index] = position[name] + self.align(node.inplace_offset)
+            group['name'] += '+' + output['name']
+            group['tensors'] += output['tensors']
+            group['size'] = max(group['size'], position[node.output_index] + output['size'])
+            group['end'] = max(group['end'], output['end'])
+        buffers = list(groups.values())
+        for i, node in enumerate(PULP_Nodes_Graph):
+            if not has_weights(node):
+                continue
+            if i == 0:
+                size = int(node.weights_dimension * self.BitW / 8.0)
+            else:
+                size = int((node.weights_dimension - PULP_Nodes_Graph[i-1].weights_dimension) * self.BitW / 8.0)
+            if i in self.resident:
+                buffers.append({'name': 'weights' + str(i), 'tensors': [], 'size': self.align(size), 'begin': 0, 'end': len(PULP_Nodes_Graph) - 1, 'pinned': False, 'resident': True})
+            else:
+                buffers.append({'name': 'weights' + str(i), 'tensors': [], 'size': self.align(size), 'begin': max(i - prefetch_depth, 0), 'end': i, 'pinned': False})
+        return buffers, position
+
+    def place(self, buffer, placed):
+        # lowest aligned offset not overlapping the buffers placed with an intersecting lifetime
+        busy = sorted([(other['offset'], other['offset'] + other['size']) for other in placed
+                       if other['begin'] <= buffer['end'] and buffer['begin'] <= other['end']])
+        offset = 0
+        for begin, end in busy:
+            if offset + buffer['size'] <= begin:
+                break
+            offset = max(offset, end)
+        return offset
+
+    def allocate(self, buffers):
+        # the network input is placed first, at the beginning of the L2 buffer, where the application writes it.
+        # Resident weights are placed last, in the space the others leave free in all the layers
+        order = [buffer for buffer in buffers if buffer['pinned']] + \
+            sorted([buffer for buffer in buffers if not buffer['pinned'] and not buffer.get('resident', False)], key=lambda buffer: (-buffer['size'], buffer['begin'])) + \
+            sorted([buffer for buffer in buffers if buffer.get('resident', False)], key=lambda buffer: -buffer['size'])
+        placed = []
+        for buffer in order:
+            buffer['offset'] = self.place(buffer, placed)
+            placed.append(buffer)
+        return max([buffer['offset'] + buffer['size'] for buffer in buffers] + [0])
+
+    def resident_weights(self, PULP_Nodes_Graph, buffers, capacity, cost_model):
+        # 0/1 knapsack: layers whose weights are kept in L2, maximizing the HyperRAM cycles saved at each inference
+        # with their total size within capacity. Weights tiled from L3 by their layer are never candidates.
+        candidates = [buffer for buffer in buffers if buffer['name'].startswith('weights')
+                      and PULP_Nodes_Graph[int(buffer['name'][7:])].L3_allocation != 1]
+        units = int(capacity / L2_ALIGNMENT)
+        if units <= 0 or len(candidates) == 0:
+            return []
+        saved = np.zeros(units + 1)
+        taken = np.zeros((len(candidates), units + 1), dtype=bool)
+        for j, buffer in enumerate(candidates):
+            size = int(buffer['size'] / L2_ALIGNMENT)
+            if size > units:
+                continue
+            with_item = saved[:units + 1 - size] + cost_model.hyperram_read_cycles(buffer['size'])
+            taken[j, size:] = with_item > saved[size:]
+            saved[size:] = np.maximum(saved[size:], with_item)
+        resident = []
+        for j in range(len(candidates) - 1, -1, -1):
+            if taken[j, units]:
+                resident.append(int(candidates[j]['name'][7:]))
+                units -= int(candidates[j]['size'] / L2_ALIGNMENT)
+        return sorted(resident)
+
+    def plan(self, PULP_Nodes_Graph, input_size, prefetch_depth=1, cost_model=None):
+        check_graph(PULP_Nodes_Graph)
+        self.resident = []
+        for depth in range(max(prefetch_depth, 1), 0, -1):
+            buffers, position = self.buffers(PULP_Nodes_Graph, input_size, depth)
+            peak = self.allocate(buffers)
+            if peak <= self.l2_buffer_size:
+                break
+        self.prefetch_depth = depth
+        if cost_model is not None and peak < self.l2_buffer_size:
+            # resident weights fill the L2 free in all the layers; their prefetch buffers are released.
+            # The first fit placement of the other buffers can change: the cheapest ones are dropped until the plan fits again
+            self.resident = self.resident_weights(PULP_Nodes_Graph, buffers, self.l2_buffer_size - peak, cost_model)
+            while True:
+                buffers, position = self.buffers(PULP_Nodes_Graph, input_size, depth)
+                peak = self.allocate(buffers)
+                if peak <= self.l2_buffer_size or len(self.resident) == 0:
+                    break
+                sizes = {int(buffer['name'][7:]): buffer['size'] for buffer in buffers if buffer.get('resident', False)}
+                self.resident.remove(min(self.resident, key=lambda i: (cost_model.hyperram_read_cycles(sizes[i]), i)))
+        # tensor table: the network input first, then the outputs in the order of the layers
+        producer, last_use = tensor_lifetimes(PULP_Nodes_Graph)
+        offsets = {}
+        for buffer in buffers:
+            for name in buffer['tensors']:
+                offsets[name] = buffer['offset'] + position[name]
+        names = sorted(producer.keys(), key=lambda name: producer[name])
+        self.tensors = [{'name': name, 'producer': producer[name], 'last_use': last_use[name], 'offset': offsets[name],
+                         'size': input_size if producer[name] == -1 else PULP_Nodes_Graph[producer[name]].output_activation_dimensions}
+                        for name in names]
+        for i, node in enumerate(PULP_Nodes_Graph):
+            # for Add layers the first input is the output of the previous layer, if it is one of the two
+            inputs = layer_inputs(node)
+            if len(inputs) == 2 and i > 0 and inputs[1] == PULP_Nodes_Graph[i-1].output_index:
+                inputs = [inputs[1], inputs[0]]
+            PULP_Nodes_Graph[i].input_tensor = names.index(inputs[0])
+            PULP_Nodes_Graph[i].input_add_tensor = names.index(inputs[1]) if len(inputs) == 2 else -1
+            PULP_Nodes_Graph[i].output_tensor = names.index(node.output_index)
+            PULP_Nodes_Graph[i].L2_weights_offset = 0
+            PULP_Nodes_Graph[i].weights_resident = int(i in self.resident)
+        for buffer in buffers:
+            if buffer['name'].startswith('weights'):
+                PULP_Nodes_Graph[int(buffer['name'][7:])].L2_weights_offset = buffer['offset']
+        # end of the last buffer live in each layer, compared at runtime with the L2 used (MEMORY_STATISTICS)
+        for i, node in enumerate(PULP_Nodes_Graph):
+            node.L2_extent = max([buffer['offset'] + buffer['size'] for buffer in buffers if buffer['begin'] <= i and i <= buffer['end']] + [0])
+        self.log(PULP_Nodes_Graph, buffers, peak)
+        if peak > self.l2_buffer_size:
+            print("L2 memory planning: " + str(peak) + " bytes needed, " + str(self.l2_buffer_size) + " available. Exiting...")
+            os._exit(0)
+        return peak
+
+    def log(self, PULP_Nodes_Graph, buffers, peak):
+        logging.debug("  ")
+        logging.debug("  L2 memory plan")
+        for buffer in sorted(buffers, key=lambda buffer: buffer['offset']):
+            logging.debug("  " + buffer['name'].ljust(30) + "offset " + str(buffer['offset']).ljust(15) + "size " + str(buffer['size']).ljust(15) +
+                          "layers " + str(buffer['begin']) + "-" + str(buffer['end']))
+        for i, _ in enumerate(PULP_Nodes_Graph):
+            live = sum([buffer['size'] for buffer in buffers if buffer['begin'] <= i and i <= buffer['end']])
+            logging.debug("  Layer " + str(i).ljust(12) + "live L2 " + str(live).ljust(15) + "free L2 " + str(self.l2_buffer_size - live))
+        logging.debug("  Peak L2: " + str(peak) + " of " + str(self.l2_buffer_size) + " bytes, weights prefetched " + str(self.prefetch_depth) + " layers ahead")
+        if len(self.resident) > 0:
+            logging.debug("  Weights resident in L2: layers " + str(self.resident) + ", " +
+                          str(sum([buffer['size'] for buffer in buffers if buffer.get('resident', False)])) + " bytes")
+
+
+class L3_memory_planner(L2_memory_planner):
+    # Static planning of the HyperRAM (L3) used by the network.
+    # - weights: the weights files of all the layers, followed by the input of the network (inputs.hex);
+    # - activations: outputs of the layers tiled to L3. Each one lives from its producer to the next layer, the only
+    #   one reading it (see check_graph), and is placed as the L2 buffers, lowest free offset with the largest first.
+    def __init__(self, BitW=8):
+        L2_memory_planner.__init__(self, 0, BitW)
+        self.weights_size = 0
+        self.activations_size = 0
+
+    def plan(self, PULP_Nodes_Graph, weights_size, input_size):
+        buffers = []
+        for i, node in enumerate(PULP_Nodes_Graph):
+            node.L3_input_offset = 0
+            node.L3_output_offset = 0
+            if node.L3_output == 1:
+                buffers.append({'name': 'output' + str(i), 'size': self.align(node.output_activation_dimensions_L3), 'begin': i, 'end': i + 1})
+        placed = []
+        for buffer in sorted(buffers, key=lambda buffer: (-buffer['size'], buffer['begin'])):
+            buffer['offset'] = self.place(buffer, placed)
+            placed.append(buffer)
+        for buffer in buffers:
+            i = buffer['begin']
+            PULP_Nodes_Graph[i].L3_output_offset = buffer['offset']
+            PULP_Nodes_Graph[i + 1].L3_input_offset = buffer['offset']
+        self.weights_size = self.align(weights_size + input_size)
+        self.activations_size = max([buffer['offset'] + buffer['size'] for buffer in buffers] + [0])
+        logging.debug("  ")
+        logging.debug("  L3 memory plan")
+        logging.debug("  " + "weights+input".ljust(30) + "size " + str(self.weights_size))
+        for buffer in sorted(buffers, key=lambda buffer: buffer['offset']):
+            logging.debug("  " + buffer['name'].ljust(30) + "offset " + str(buffer['offset']).ljust(15) + "size " + str(buffer['size']).ljust(15) +
+                          "layers " + str(buffer['begin']) + "-" + str(buffer['end']))
+        logging.debug("  Total L3: " + str(self.weights_size + self.activations_size) + " bytes")
+        return self.weights_size + self.activations_size
+
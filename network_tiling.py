@@ -0,0 +1,185 @@
+#
+# network_tiling.py
+# Alessio Burrello <alessio.burrello@unibo.it>
+#
+# Copyright (C) 2019-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import logging
+import math
+from memory_planning import weights_bytes
+
+INFEASIBLE = float('inf')
+
+
+class Network_tiling():
+    # Whole-network planning of the L2 memory, solved before the per-layer tiling.
+    # For each layer with weights it decides if the weights are prefetched in L2 during the previous layer
+    # ('full') or tiled from L3 inside the layer ('tiled'). This fixes the L2 space reserved for the weights of
+    # the next layer (weight_overhead in create_layers_tiling), hence the L2 budget of each layer and which
+    # activations have to be tiled from L3, also together with the weights (see get_tiling_conv2d_L3). The choice is
+    # a shortest path over the chain of layers, minimizing the predicted latency of the network (or the peak L2
+    # first, with objective='L2').
+    # The plan is joint at the L3-L2 level only: the L2-L1 tiles of each layer are then still solved one layer at
+    # a time by Tiling, within the L2 budget left to the layer by the plan, and the plan estimates the compute of
+    # a layer from its MACs without knowing its L2-L1 tiling.
+    def __init__(self, cost_model, l2_buffer_size, BitActivation, objective='latency'):
+        self.cost_model = cost_model
+        self.l2_buffer_size = l2_buffer_size
+        self.BitActivation = BitActivation
+        self.objective = objective
+
+    def has_weights(self, node):
+        return 'Conv' in node.name or 'Gemm' in node.name or 'MatMul' in node.name
+
+    def layer_features(self, node, BitIn, BitW, BitOut):
+        # bytes of input, output, weights (+ k and lambda) and the compute estimate of a layer
+        features = {}
+        features['input'] = int(node.input_channels * node.groups * node.input_h * node.input_w * BitIn / 8)
+        features['output'] = int(node.output_channels * node.output_h * node.output_w * BitOut / 8)
+        if self.has_weights(node):
+            features['weights'] = weights_bytes(node, BitW, self.BitActivation)
+        if 'Fused' in node.name:
+            # depthwise + pointwise fused layer: the name contains the names of both layers
+            pw = node.fused
+            pw_family = self.cost_model.kernel_family(pw.name, 0, pw.filter_size_h, pw.filter_size_w, pw.stride)
+            features['compute'] = (self.cost_model.layer_compute_cycles('depthwise', node.MACs - pw.MACs)
+                                   + self.cost_model.layer_compute_cycles(pw_family, pw.MACs))
+        elif self.has_weights(node):
+            DW = 1 if 'DW' in node.name else 0
+            family = self.cost_model.kernel_family(node.name, DW, node.filter_size_h, node.filter_size_w, node.stride)
+            features['compute'] = self.cost_model.layer_compute_cycles(family, node.MACs)
+        else:
+            features['weights'] = 0
+            family = self.cost_model.kernel_family(node.name, 0, node.filter_size_h, node.filter_size_w, node.stride)
+            features['compute'] = self.cost_model.layer_compute_cycles(family, node.input_channels * node.groups * node.input_h * node.input_w)
+        return features
+
+    def states(self, i, features):
+        if features[i]['weights'] == 0:
+            return ['none']
+        if i == 0:
+            # weights of the first layer are always copied before the execution of the network
+            return ['full']
+        return ['full', 'tiled']
+
+    def reserve(self, state, features):
+        # L2 space reserved, during a layer, for the weights of the next one
+        if state == 'full':
+            return features['weights']
+        elif state == 'tiled':
+            return int(self.l2_buffer_size / 2)
+        return 0
+
+    def layer_cost(self, i, state, next_state, features):
+        # predicted cycles and L2 occupation of layer i, given how its weights and the ones of the next layer are managed
+        f = features[i]
+        budget = self.l2_buffer_size - self.reserve(next_state, features[i + 1] if i + 1 < len(features) else {'weights': 0})
+        cycles = f['compute']
+        if state == 'tiled':
+            # weights streamed from L3 in the layer, double buffered in up to half of the budget
+            weights_L2 = min(f['weights'], int(budget / 2))
+            if f['input'] + f['output'] + weights_L2 <= budget:
+                cycles += self.cost_model.hyperram_cycles(f['weights'])
+                return cycles, f['input'] + f['output'] + weights_L2 + self.l2_buffer_size - budget
+            # input and output activations tiled from L3 as well, double buffered in the rest of the budget.
+            # The loop nest re-reads the weights for each activation tile, or the inputs for each weight tile:
+            # the cheaper order is used, weights outer only if the output stays in L2.
+            activations_L2 = budget - weights_L2
+            if activations_L2 <= 0:
+                return INFEASIBLE, INFEASIBLE
+            n_tile_act = int(math.ceil(2 * (f['input'] + f['output']) / activations_L2))
+            n_tile_W = int(math.ceil(2 * f['weights'] / weights_L2))
+            traffic = f['weights'] * n_tile_act + f['input'] + f['output']
+            if f['output'] <= activations_L2 / 2:
+                traffic = min(traffic, f['weights'] + f['input'] * n_tile_W + f['output'])
+            cycles += self.cost_model.hyperram_cycles(traffic)
+            return cycles, self.l2_buffer_size
+        weights_L2 = f['weights']
+        if state == 'full' and i > 0:
+            # weights are prefetched during the previous layer: only the part not hidden by it is paid
+            cycles += max(0, self.cost_model.hyperram_cycles(f['weights']) - features[i - 1]['compute'])
+        if f['input'] + f['output'] + weights_L2 <= budget:
+            return cycles, f['input'] + f['output'] + weights_L2 + self.l2_buffer_size - budget
+        if weights_L2 > budget / 2:
+            return INFEASIBLE, INFEASIBLE
+        # input and output activations tiled from L3
+        cycles += self.cost_model.hyperram_cycles(f['input'] + f['output'])
+        return cycles, self.l2_buffer_size
+
+    def better(self, a, b):
+        # a and b are (latency, peak L2)
+        if self.objective == 'L2':
+            return (a[1], a[0]) < (b[1], b[0])
+        return (a[0], a[1]) < (b[0], b[1])
+
+    def plan(self, PULP_Nodes_Graph, bits):
+        # bits is the list of (BitIn, BitW, BitOut) of each layer.
+        # Returns, for each layer, the L2 space to reserve for the weights of the next layer and
+        # whether these weights will be tiled from L3.
+        features = [self.layer_features(node, *bits[i]) for i, node in enumerate(PULP_Nodes_Graph)]
+        number_of_layers = len(features)
+        # best[i][state] = ((latency, peak L2), path) of layers 0..i-1, with layer i in state
+        best = [{} for _ in range(number_of_layers + 1)]
+        for state in self.states(0, features):
+            best[0][state] = ((0, 0), [state])
+        for i in range(number_of_layers):
+            next_states = self.states(i + 1, features) if i + 1 < number_of_layers else ['none']
+            for state, (value, path) in best[i].items():
+                for next_state in next_states:
+                    cycles, l2 = self.layer_cost(i, state, next_state, features)
+                    if cycles == INFEASIBLE:
+                        continue
+                    new_value = (value[0] + cycles, max(value[1], l2))
+                    if next_state not in best[i + 1] or self.better(new_value, best[i + 1][next_state][0]):
+                        best[i + 1][next_state] = (new_value, path + [next_state])
+        if len(best[number_of_layers]) == 0:
+            print("Network tiling: no feasible L2 plan found. Exiting...")
+            logging.debug("  Network tiling: no feasible L2 plan found")
+            return None
+        value, path = best[number_of_layers]['none']
+        greedy = self.evaluate_greedy(features)
+        logging.debug("  ")
+        logging.debug("  Network tiling plan (objective: " + self.objective + "):")
+        for i, node in enumerate(PULP_Nodes_Graph):
+            logging.debug("    Layer " + str(i).ljust(4) + node.name.ljust(20) + "weights: " + path[i].ljust(8) +
+                          "L2 reserved for next weights: " + str(self.reserve(path[i + 1], features[i + 1] if i + 1 < number_of_layers else {'weights': 0})))
+        logging.debug("    Predicted cycles: " + str(int(value[0])) + ", peak L2: " + str(value[1]) + " B")
+        if greedy is not None:
+            logging.debug("    Layer by layer heuristic: predicted cycles: " + str(int(greedy[0])) + ", peak L2: " + str(greedy[1]) + " B")
+        plan = []
+        for i in range(number_of_layers):
+            next_features = features[i + 1] if i + 1 < number_of_layers else {'weights': 0}
+            plan.append((self.reserve(path[i + 1], next_features), path[i + 1] == 'tiled'))
+        return plan
+
+    def evaluate_greedy(self, features):
+        # cost of the layer by layer rule: weights bigger than half L2 are always tiled from L3
+        path = []
+        for i, f in enumerate(features):
+            if f['weights'] == 0:
+                path.append('none')
+            elif i > 0 and f['weights'] > int(self.l2_buffer_size / 2):
+                path.append('tiled')
+            else:
+                path.append('full')
+        path.append('none')
+        latency, peak = 0, 0
+        for i in range(len(features)):
+            cycles, l2 = self.layer_cost(i, path[i], path[i + 1], features)
+            if cycles == INFEASIBLE:
+                return None
+            latency += cycles
+            peak = max(peak, l2)
+        return latency, peak
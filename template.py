@@ -17,6 +17,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import logging
 import math
 from mako.template import Template
 import re
@@ -304,6 +305,11 @@ def print_template_network(
     master_stack = 4096,
     slave_stack = 3072,
     l2_buffer_size = 400000,
+    l2_peak = 400000,
+    tensors = [],
+    prefetch_depth = 1,
+    l3_weights_size = 4800000,
+    l3_activations_size = 1500000,
     fc_frequency = 100000000,
     cl_frequency = 100000000,
     MACs = 1,
@@ -345,6 +351,11 @@ def print_template_network(
     tk['master_stack'] = master_stack
     tk['slave_stack'] = slave_stack
     tk['l2_buffer_size'] = l2_buffer_size
+    tk['l2_peak'] = l2_peak
+    tk['tensors'] = tensors
+    tk['prefetch_depth'] = prefetch_depth
+    tk['l3_weights_size'] = l3_weights_size
+    tk['l3_activations_size'] = l3_activations_size
     tk['MACs'] = MACs
     tk['files_list'] = print_file_list(file_list_w)
     tk['test'] = test
@@ -423,6 +434,7 @@ def print_pool_template_layer_L3(X, W, Y, fs1, fs2, padding, stride,
     tk['n_tile_W'] = int(factor_ch_out)
     tk['n_tile_x'] = int(factor_h_in)
     tk['n_tile_y'] = int(factor_h_out)
+    tk['loop_order'] = 'activations'
     tk['verbose'] = False
     tk['func_name'] = name
     tk['func_name_L3'] = name[0] + 'L3'
@@ -502,7 +514,9 @@ def print_template_layer_L3(X, W, Y, fs1, fs2, padding, stride,
                             test_location,
                             out_mul, out_shift,
                             buffer_l1_all,
-                            input_L3
+                            input_L3,
+                            loop_order='activations',
+                            bias_dim=0
                             ):
     # generation of L3 layers. The layers are generated with this infrustructure if an L3 tiling is demanded.
     tk = OrderedDict([])
@@ -515,6 +529,8 @@ def print_template_layer_L3(X, W, Y, fs1, fs2, padding, stride,
     tk['n_tile_W'] = int(factor_ch_out)
     tk['n_tile_x'] = int(factor_h_in)
     tk['n_tile_y'] = int(factor_h_out)
+    # 'activations' or 'weights': tiles of the outer loop of the L3 loop nest
+    tk['loop_order'] = loop_order
     tk['verbose'] = False
     tk['func_name'] = name
     tk['func_name_L3'] = name[0] + 'L3'
@@ -522,6 +538,9 @@ def print_template_layer_L3(X, W, Y, fs1, fs2, padding, stride,
     tk['weight_dim'] = int(weight_dim1)
     tk['lambda_dim'] = lambda_dim
     tk['k_dim'] = k_dim
+    tk['bias_dim'] = bias_dim
+    # one L3 weight tile: weights, bias, k and lambda of n_out / n_tile_W output channels
+    tk['weight_tile_dim'] = int(weight_dim1) + bias_dim + k_dim + lambda_dim
     tk['w_out'] = w_out
     tk['h_out'] = h_out
     tk['n_out'] = n_out
@@ -575,6 +594,114 @@ def print_template_layer_L3(X, W, Y, fs1, fs2, padding, stride,
         save_string = './application/DORY_network/src/main.c'
         with open(save_string, "w") as f: f.write(s)
 
+def dma_commands(tk, DW, tile_n_in, tile_h_in):
+    # DMA commands programmed by the tile loop of layer_template.c, summed over the cores:
+    # with one 3d copy per tile and with the transfers of the contiguous tiles merged.
+    def merged(size):
+        return int(math.ceil(size / 65532.0))
+    if DW == 1:
+        tiles = tk['tile_dim_nof'] * tk['tile_dim_h'] * tk['tile_dim_w']
+        weight_loads = tk['tile_dim_nof']
+    else:
+        tiles = tk['tile_dim_nof'] * tk['tile_dim_nif'] * tk['tile_dim_h'] * tk['tile_dim_w']
+        weight_loads = tk['tile_dim_nof'] * tk['tile_dim_nif']
+    if DW == 1 and tk['hwc_to_chw_L1'] == 0:
+        # hwc to chw transposition: a transfer per channel, and per row if w is tiled
+        x_commands = tile_n_in * (tile_h_in if tk['tile_dim_w'] > 1 else 1)
+    else:
+        x_commands = tile_h_in
+    y_commands = tk['y_tile_size_h']
+    # the first weight tile is copied row by row, the next ones with dory_dma_memcpy_3d_custom_weights
+    W_first_commands = 1 if DW == 1 else tk['W_tile_size_nof']
+    W_commands = 1 if tk['W_contiguous'] == 1 else tk['W_tile_size_nof']
+    commands = tiles * (x_commands + y_commands) + W_first_commands + (weight_loads - 1) * W_commands
+    if tk['x_contiguous'] == 1:
+        x_commands = merged(tk['x_tile_size_byte'])
+    if tk['y_contiguous'] == 1:
+        y_commands = merged(tk['y_tile_size_byte'])
+    if tk['W_contiguous'] == 1:
+        W_first_commands = merged(tk['W_tile_size_byte'])
+    commands_merged = tiles * (x_commands + y_commands) + W_first_commands + (weight_loads - 1) * W_commands
+    return commands, commands_merged
+
+def tile_schedule(tk, DW):
+    # Tiles of the tile loop of layer_template.c, in loop order (nof, h, w, nif; nif follows nof in depthwise layers).
+    # For each tile: the copies of x, W, k/lambda and y as (ext, loc, size, length_2, length_0), and the kernel
+    # arguments as (x_nif, x_h, x_w, y_nof, y_h, y_w, b_loc, p_t, p_b, p_l, p_r).
+    # Same arithmetic of dory_get_tile_3d and of the last-tile selects, done once here instead of at every tile.
+    # The L1 slots of the ring of buffers depend only on the tile index: x and y rotate at every tile,
+    # W, k and lambda when the weights change.
+    def get_tile_3d(ii, jj, kk, size_i, size_j, size_k, stride_j, stride_k, overlap_i, overlap_j, offset_i, offset_j, data_size):
+        return ((ii * (size_i - overlap_i) - offset_i) * stride_j * stride_k * data_size // 8
+                + (jj * (size_j - overlap_j) - offset_j) * stride_k * data_size // 8
+                + kk * size_k * data_size // 8)
+    def last(index, dim, size, size_last):
+        return size_last if index + 1 == dim else size
+    n_buffers = tk['n_buffers']
+    x_tiles = tk['tile_dim_nif'] * tk['tile_dim_h'] * tk['tile_dim_w']
+    tiles_dma = []
+    tiles_args = []
+    W_slot = 0
+    previous = None
+    for i_nof in range(tk['tile_dim_nof']):
+        for i_h in range(tk['tile_dim_h']):
+            for i_w in range(tk['tile_dim_w']):
+                for i_nif in ([i_nof] if DW == 1 else range(tk['tile_dim_nif'])):
+                    t = len(tiles_dma)
+                    W_load = previous is None or previous != (i_nof, i_nif)
+                    if W_load and previous is not None:
+                        W_slot = (W_slot + 1) % n_buffers
+                    previous = (i_nof, i_nif)
+                    # x
+                    x_nif = last(i_nif, tk['tile_dim_nif'], tk['x_tile_size_nif'], tk['x_tile_size_nif_last'])
+                    x_h = last(i_h, tk['tile_dim_h'], tk['x_tile_size_h'], tk['x_tile_size_h_last'])
+                    x_w = last(i_w, tk['tile_dim_w'], tk['x_tile_size_w'], tk['x_tile_size_w_last'])
+                    x_ext = get_tile_3d(i_h, i_w, i_nif, tk['x_tile_size_h'], tk['x_tile_size_w'], tk['x_tile_size_nif'],
+                                        tk['x_w'], tk['nif'] * tk['g'], tk['conv_overlap1'], tk['conv_overlap2'],
+                                        tk['padding_top'] if i_h > 0 else 0, tk['padding_left'] if i_w > 0 else 0,
+                                        tk['x_data_size_byte'])
+                    x_loc = tk['l1_x_offset'] + (t % n_buffers * tk['x_slot_size_byte'] if x_tiles != 1 else 0)
+                    x_copy = (x_ext, x_loc, x_nif * x_h * x_w * tk['x_data_size_byte'] // 8, x_h,
+                              last(i_nif, tk['tile_dim_nif'], tk['x_tile_size_nif_byte'], tk['x_tile_size_nif_byte_last']))
+                    # W
+                    W_nof = last(i_nof, tk['tile_dim_nof'], tk['W_tile_size_nof'], tk['W_tile_size_nof_last'])
+                    W_nif = last(i_nif, tk['tile_dim_nif'], tk['W_tile_size_nif'], tk['W_tile_size_nif_last'])
+                    if DW == 1:
+                        W_ext = i_nof * tk['W_tile_size_nof'] * 8 // tk['W_data_size_byte'] * tk['fs1'] * tk['fs2'] * tk['nif'] * tk['W_data_size_byte'] // 8
+                        W_size = W_nof * W_nif * tk['fs1'] * tk['fs2']
+                    else:
+                        W_ext = (i_nof * tk['W_tile_size_nof'] * tk['fs1'] * tk['fs2'] * tk['nif'] * tk['W_data_size_byte'] // 8
+                                 + i_nif * tk['W_tile_size_nif'] * tk['W_data_size_byte'] // 8)
+                        W_size = W_nof * W_nif * tk['W_data_size_byte'] * tk['fs1'] * tk['fs2'] // 8
+                    W_copy = (W_ext, tk['l1_W_offset'] + W_slot * tk['W_tile_size_byte'], W_size if W_load else 0, W_nof,
+                              last(i_nif, tk['tile_dim_nif'], tk['W_tile_nif_byte'], tk['W_tile_size_nif_byte_last']))
+                    # k and lambda
+                    if tk['FLAG_BATCHNORM'] == 1:
+                        act_copy = (tk['k_tile_size_byte_transfer'] * i_nof,
+                                    tk['k_tile_size_byte_transfer'] * (i_nof if tk['BN_whole'] == 1 else W_slot),
+                                    W_nof * int(tk['act_dim_bit'] / 8) if W_load and tk['BN_whole'] == 0 else 0, 1, 0)
+                    else:
+                        act_copy = (0, 0, 0, 0, 0)
+                    # y, written back after the last tile of the input channels
+                    y_nof = last(i_nof, tk['tile_dim_nof'], tk['y_tile_size_nof'], tk['y_tile_size_nof_last'])
+                    y_h = last(i_h, tk['tile_dim_h'], tk['y_tile_size_h'], tk['y_tile_size_h_last'])
+                    y_w = last(i_w, tk['tile_dim_w'], tk['y_tile_size_w'], tk['y_tile_size_w_last'])
+                    y_ext = get_tile_3d(i_h, i_w, i_nof, tk['y_tile_size_h'], tk['y_tile_size_w'], tk['y_tile_size_nof'],
+                                        tk['y_w'], int(tk['nof'] * tk['factor']), 0, 0, 0, 0, tk['y_data_size_byte'])
+                    y_loc = tk['l1_y_offset'] + (t % n_buffers * tk['y_tile_size_byte'] if tk['y_slots'] != 1 else 0)
+                    y_store = DW == 1 or i_nif + 1 == tk['tile_dim_nif']
+                    y_copy = (y_ext, y_loc, y_nof * y_h * y_w * tk['y_data_size_byte'] // 8 if y_store else 0, y_h,
+                              last(i_nof, tk['tile_dim_nof'], tk['y_tile_size_nof_byte'], tk['y_length_nof_byte_last']))
+                    tiles_dma.append((x_copy, W_copy, act_copy, y_copy))
+                    tiles_args.append((x_nif, x_h, x_w, y_nof, y_h, y_w,
+                                       i_nof * tk['bias_tile_size_byte'],
+                                       tk['padding_top'] if i_h == 0 else 0,
+                                       tk['padding_bottom'] if i_h == tk['tile_dim_h'] - 1 else 0,
+                                       tk['padding_left'] if i_w == 0 else 0,
+                                       tk['padding_right'] if i_w == tk['tile_dim_w'] - 1 else 0))
+    return tiles_dma, tiles_args
+
+
 def print_template_layer(x, y_gold, W,
                          n_in, h_in, w_in,
                          n_out,h_out, w_out,
@@ -597,7 +724,10 @@ def print_template_layer(x, y_gold, W,
                          optional_type='8bit',
                          L3_tiling = 0,
                          sdk = 'gap_sdk',
-                         dma_parallelization = '8-cores'
+                         dma_parallelization = '8-cores',
+                         multiple_buffering_factor = 2,
+                         BN_whole = 0,
+                         hwc_to_chw_L1 = 0
                          ):
     # Generate the Layer management c file.
     if h_out * stride + fs1 - 1 - stride + 1 > h_in:
@@ -628,9 +758,13 @@ def print_template_layer(x, y_gold, W,
     tk = OrderedDict([])
     tk['sdk'] = sdk
     tk['dma_parallelization'] = dma_parallelization
+    # depth of the ring of L1 buffers of the tiled tensors: 2 is plain double buffering
+    tk['n_buffers'] = multiple_buffering_factor
     tk['optional_type'] = optional_type
     tk['func_name'] = name
     tk['flag_DW'] = DW
+    # depthwise input tiles copied in HWC and transposed by the cores in L1 (chosen by Tiling.hwc_to_chw_layer)
+    tk['hwc_to_chw_L1'] = hwc_to_chw_L1 if DW == 1 and conv_order == 'PULP-NN' and ds_x == 8 else 0
     tk['optional'] = optional
     tk['FLAG_BATCHNORM'] = BN
     tk['has_bias'] = has_bias
@@ -719,22 +853,27 @@ def print_template_layer(x, y_gold, W,
             math.ceil((tk['nof'] * tk['nif'] * fs1 * fs2 * ds_W + tk['nof'] * ds_act) / 8.0 + tk['b_size_byte']))
     if has_bias == 1:
         tk['l2_off_bias'] = int(math.ceil(tk['nof'] * tk['nif'] * fs1 * fs2 * ds_W / 8.0 ))
-    if n_in == tile_n_in and w_in == tile_w_in and h_in == tile_h_in:
-        x_buffer_size = int(math.ceil(ds_x * tile_n_in * tile_h_in * tile_w_in / 8.0))
-    else:
-        x_buffer_size = 2 * int(math.ceil(ds_x * tile_n_in * tile_h_in * tile_w_in / 8.0))
-    if n_in == tile_n_in and w_in == tile_w_in and h_in == tile_h_in and n_out == tile_n_out:
-        y_buffer_size = int(math.ceil(ds_y * tk['y_tile_size_nof'] * tk['y_tile_size_h'] * tk['y_tile_size_w'] / 8.0))
-        if DW == 0:
-            W_buffer_size = int(math.ceil(ds_W * tk['y_tile_size_nof']  * tile_n_in * fs1 * fs2 / 8.0))
-        else:
-            W_buffer_size = int(math.ceil(ds_W * tk['y_tile_size_nof']  * 1 * fs1 * fs2 / 8.0))
+    # L1 slots of the buffers of the tile loop. The ring of multiple_buffering_factor slots is needed only by the
+    # buffers loaded (or written back) while another tile is computed:
+    # - a layer made of a single tile needs one slot for everything;
+    # - weights, k and lambda of a convolution whose channels are not tiled are loaded once, before the loop;
+    # - the output of depthwise layers is written back with a blocking transfer before the next tile is computed.
+    # im2col and pwt_buffer are used by the kernel while the DMA fills the other slots: they cannot alias the
+    # buffers above and stay after buffer_l1_all. Same rules of Tiling.conv2d_l1_occupation.
+    single_tile = n_in == tile_n_in and w_in == tile_w_in and h_in == tile_h_in and n_out == tile_n_out
+    x_slots = 1 if n_in == tile_n_in and w_in == tile_w_in and h_in == tile_h_in else multiple_buffering_factor
+    y_slots = 1 if single_tile or (conv_order == 'PULP-NN' and DW == 1) else multiple_buffering_factor
+    W_slots = 1 if single_tile or (conv_order == 'PULP-NN' and n_in == tile_n_in and n_out == tile_n_out) else multiple_buffering_factor
+    tk['y_slots'] = y_slots
+    # the slots of depthwise input tiles transposed in L1 start at 4 bytes boundaries, as needed by the 32 bits
+    # accesses of dory_hwc_to_chw
+    tk['x_slot_size_byte'] = int(math.ceil(tk['x_tile_size_byte'] / 4.0) * 4) if tk['hwc_to_chw_L1'] == 1 else tk['x_tile_size_byte']
+    x_buffer_size = x_slots * tk['x_slot_size_byte']
+    y_buffer_size = y_slots * int(math.ceil(ds_y * tk['y_tile_size_nof'] * tk['y_tile_size_h'] * tk['y_tile_size_w'] / 8.0))
+    if DW == 0:
+        W_buffer_size = W_slots * int(math.ceil(ds_W * tk['y_tile_size_nof'] * tile_n_in * fs1 * fs2 / 8.0))
     else:
-        y_buffer_size = 2 * int(math.ceil(ds_y * tk['y_tile_size_nof'] * tk['y_tile_size_h'] * tk['y_tile_size_w'] / 8.0))
-        if DW == 0:
-            W_buffer_size = 2 * int(math.ceil(ds_W * tk['y_tile_size_nof'] * tile_n_in * fs1 * fs2 / 8.0))
-        else:
-            W_buffer_size = 2 * int(math.ceil(ds_W * tk['y_tile_size_nof'] * 1 * fs1 * fs2 / 8.0))
+        W_buffer_size = W_slots * int(math.ceil(ds_W * tk['y_tile_size_nof'] * 1 * fs1 * fs2 / 8.0))
     if tk['FLAG_BATCHNORM'] == 1:
         k_buffer_size = int(n_out * ds_act / 8.0)
         lambd_buffer_size = int(n_out * ds_act / 8.0)
@@ -746,18 +885,20 @@ def print_template_layer(x, y_gold, W,
     tk['lambda_tile_size_byte'] = 0
     tk['k_size_byte'] = 0
     tk['lambda_size_byte'] = 0
+    # k and lambda of the whole layer loaded once before the tile loop, as the bias (chosen by Tiling.bn_whole_layer)
+    tk['BN_whole'] = BN_whole if tk['FLAG_BATCHNORM'] == 1 and conv_order == 'PULP-NN' else 0
     if conv_order != 'PULP-NN-MAX':
         if tk['FLAG_BATCHNORM'] == 1:
             tk['k_size_byte'] = k_buffer_size
             tk['lambda_size_byte'] = k_buffer_size
             tk['k_tile_size_byte_transfer'] = int(math.ceil(tile_n_out * ds_act / 8.0))
             tk['lambda_tile_size_byte_transfer'] = int(math.ceil(tile_n_out * ds_act / 8.0))
-            if n_in == tile_n_in and w_in == tile_w_in and h_in == tile_h_in and n_out == tile_n_out:
-                tk['k_tile_size_byte'] = int(math.ceil(tile_n_out * ds_act / 8.0))
-                tk['lambda_tile_size_byte'] = int(math.ceil(tile_n_out * ds_act / 8.0))
+            if tk['BN_whole'] == 1:
+                tk['k_tile_size_byte'] = k_buffer_size
+                tk['lambda_tile_size_byte'] = lambd_buffer_size
             else:
-                tk['k_tile_size_byte'] = int(math.ceil(tile_n_out * ds_act / 8.0 * 2))
-                tk['lambda_tile_size_byte'] = int(math.ceil(tile_n_out * ds_act / 8.0 * 2))
+                tk['k_tile_size_byte'] = int(math.ceil(tile_n_out * ds_act / 8.0 * W_slots))
+                tk['lambda_tile_size_byte'] = int(math.ceil(tile_n_out * ds_act / 8.0 * W_slots))
         if has_bias == 1:
             tk['bias_tile_size_byte'] = tile_n_out
             tk['b_size_byte'] = int(n_out)
@@ -816,6 +957,14 @@ def print_template_layer(x, y_gold, W,
     tk['y_tile_size_h_last'] = h_out % tile_h_out if (h_out % tile_h_out) > 0 else tile_h_out
     tk['y_tile_size_w_last'] = w_out % tile_w_out if (w_out % tile_w_out) > 0 else tile_w_out
     tk['y_length_nof_byte_last'] = int(math.ceil(tk['y_tile_size_nof_last'] * ds_y / 8.0))
+    # tiles contiguous also in L2, since they span all the channels and the whole width: the 3d copies of
+    # layer_template.c are merged in a single transfer (dory_dma_memcpy_1d), split only at the 16 bits command size
+    tk['x_contiguous'] = int(tile_n_in == n_in and tile_w_in == w_in and (DW == 0 or tk['hwc_to_chw_L1'] == 1))
+    tk['y_contiguous'] = int(tk['y_tile_size_nof'] == n_out and factor_ch_out == 1 and tk['y_tile_size_w'] == w_out)
+    tk['W_contiguous'] = int(DW == 1 or tile_n_in == n_in)
+    tk['dma_commands'], tk['dma_commands_merged'] = dma_commands(tk, DW, tile_n_in, tile_h_in)
+    logging.debug("    DMA commands:".ljust(18) + str(tk['dma_commands_merged']).ljust(15) +
+                  "(" + str(tk['dma_commands']) + " without merging the contiguous tiles)")
     l = ""
     for k, v in tk.items():
         try:
@@ -826,8 +975,19 @@ def print_template_layer(x, y_gold, W,
             except TypeError:
                 l += "// %s %s\n" % (k.ljust(30), v)
     if conv_order == 'PULP-NN':
+        # descriptors of the copies and kernel arguments of every tile, walked by the tile loop
+        tk['tiles_dma'], tk['tiles_args'] = tile_schedule(tk, DW)
         buffer_l1_all = W_buffer_size + x_buffer_size + y_buffer_size + tk['k_tile_size_byte'] + tk['lambda_tile_size_byte'] + 40 + tk['b_size_byte']
         tk['im2col_dim'] = (8 * (fs1 * (tile_h_in + 2 * padding_top) + fs1)) * int( 8 / min(ds_x, ds_y, ds_W))
+        # kernel scratch after buffer_l1_all, as counted by Tiling.conv2d_l1_occupation
+        if DW == 0:
+            tk['l1_scratch_size'] = 2 * 8 * fs1 * fs2 * tile_n_in
+        else:
+            tk['l1_scratch_size'] = tk['im2col_dim'] + (8 * fs1 * fs2 * int( 8 / min(ds_x, ds_y, ds_W)) if ds_W < 8 else 0)
+        if tk['hwc_to_chw_L1'] == 1:
+            # CHW copy of the input tile, after the kernel scratch
+            tk['l1_x_chw_offset'] = int(math.ceil((buffer_l1_all + tk['l1_scratch_size']) / 4.0) * 4)
+            tk['l1_scratch_size'] = tk['l1_x_chw_offset'] - buffer_l1_all + tk['x_tile_size_byte']
     elif conv_order == 'PULP-NN-ADD':
         buffer_l1_all = x_buffer_size * 2 + y_buffer_size + tk['k_tile_size_byte'] + tk['lambda_tile_size_byte'] + 40 + tk['b_size_byte']
     elif conv_order == 'PULP-NN-MAX':
@@ -912,6 +1072,134 @@ def print_template_layer(x, y_gold, W,
     return l2_dim_input, l2_dim_output, l2_dim_weights, l2_dim_k, l2_dim_lambda, tk['b_size_byte'], buffer_l1_all, n_out, w_out, h_out
 
 
+def print_template_layer_fused(n_in, h_in, w_in,
+                               n_out, h_out, w_out,
+                               tile_h_in, tile_h_out,
+                               ds_x, ds_y, ds_W, ds_act, type_data,
+                               fs1, fs2, padding_top, padding_bottom, padding_left, padding_right, stride,
+                               relu, BN,
+                               out_mul, out_shift, pw_out_mul, pw_out_shift,
+                               name_layer='layer',
+                               ultra_verbose=True,
+                               l1_buffer=44000,
+                               chip='GAP8v2',
+                               sdk='gap_sdk',
+                               dma_parallelization='8-cores'
+                               ):
+    # Generate the c file of a depthwise + pointwise fused layer.
+    # The weights file of the layer contains the depthwise weights, k and lambda, padded to 4 bytes,
+    # followed by the pointwise weights, k and lambda (see create_weights_files).
+    def align(size):
+        return int(math.ceil(size / 4.0) * 4)
+    name = re.sub(r'\W', '', name_layer).replace("hex", "").replace(".", "").replace("_weights", "")
+    name_layer = name + '.h'
+    conv_overlap1 = 2 * (fs1 // 2) + fs1 % 2 - 1 - (stride - 1)
+    tk = OrderedDict([])
+    tk['sdk'] = sdk
+    tk['dma_parallelization'] = dma_parallelization
+    tk['func_name'] = name
+    tk['chip'] = chip
+    tk['type'] = type_data
+    tk['FLAG_BATCHNORM'] = BN
+    tk['FLAG_RELU'] = relu
+    tk['nif'] = n_in
+    tk['nof'] = n_out
+    tk['fs1'] = fs1
+    tk['fs2'] = fs2
+    tk['stride'] = stride
+    tk['conv_overlap1'] = conv_overlap1
+    tk['padding_top'] = padding_top
+    tk['padding_bottom'] = padding_bottom
+    tk['padding_left'] = padding_left
+    tk['padding_right'] = padding_right
+    tk['act_dim_bit'] = ds_act
+    tk['pw_out_mult'] = pw_out_mul
+    tk['pw_out_shift'] = pw_out_shift
+    # x parameters
+    tk['x_h'] = h_in
+    tk['x_w'] = w_in
+    tk['x_data_size_byte'] = ds_x
+    tk['x_tile_size_h'] = tile_h_in
+    tk['x_tile_size_byte'] = int(math.ceil(ds_x * n_in * tile_h_in * w_in / 8.0))
+    tk['x_stride_w_byte'] = int(math.ceil(w_in * n_in * ds_x / 8.0))
+    tk['x_stride_c_byte'] = int(math.ceil(n_in * ds_x / 8.0))
+    # y parameters
+    tk['y_h'] = h_out
+    tk['y_w'] = w_out
+    tk['y_data_size_byte'] = ds_y
+    tk['y_tile_size_h'] = tile_h_out
+    tk['y_tile_size_byte'] = int(math.ceil(ds_y * n_out * tile_h_out * w_out / 8.0))
+    tk['y_stride_w_byte'] = int(math.ceil(w_out * n_out * ds_y / 8.0))
+    tk['y_stride_c_byte'] = int(math.ceil(n_out * ds_y / 8.0))
+    tk['tile_dim_h'] = max(int(math.ceil(float(h_out) / float(tile_h_out))), 1)
+    # last tiles, as in print_template_layer
+    if tk['tile_dim_h'] == 1:
+        tk['x_tile_size_h_last'] = tile_h_in
+    elif tk['tile_dim_h'] == 2:
+        tk['x_tile_size_h_last'] = h_in - tile_h_in + conv_overlap1 + padding_top
+    elif tk['tile_dim_h'] == 3:
+        tk['x_tile_size_h_last'] = h_in - tile_h_in - (tile_h_in - conv_overlap1 - padding_top) + conv_overlap1
+    else:
+        tk['x_tile_size_h_last'] = h_in - tile_h_in - (tile_h_in - conv_overlap1 - padding_top) - (tk['tile_dim_h'] - 3) * (tile_h_in - conv_overlap1) + conv_overlap1
+    if tk['x_tile_size_h_last'] > tile_h_in:
+        tk['x_tile_size_h_last'] = tile_h_in
+    tk['y_tile_size_h_last'] = h_out % tile_h_out if (h_out % tile_h_out) > 0 else tile_h_out
+    # l2 parameters: offsets in the weights of the layer
+    tk['W_dw_size_byte'] = int(math.ceil(n_in * fs1 * fs2 * ds_W / 8.0))
+    tk['W_pw_size_byte'] = int(math.ceil(n_in * n_out * ds_W / 8.0))
+    tk['k_dw_size_byte'] = int(n_in * ds_act / 8.0) * BN
+    tk['k_pw_size_byte'] = int(n_out * ds_act / 8.0) * BN
+    tk['l2_off_W_dw'] = 0
+    tk['l2_off_k_dw'] = tk['W_dw_size_byte']
+    tk['l2_off_lambda_dw'] = tk['l2_off_k_dw'] + tk['k_dw_size_byte']
+    tk['l2_off_W_pw'] = align(tk['l2_off_lambda_dw'] + tk['k_dw_size_byte'])
+    tk['l2_off_k_pw'] = tk['l2_off_W_pw'] + tk['W_pw_size_byte']
+    tk['l2_off_lambda_pw'] = tk['l2_off_k_pw'] + tk['k_pw_size_byte']
+    l2_dim_weights = align(tk['l2_off_lambda_pw'] + tk['k_pw_size_byte'])
+    if tk['W_pw_size_byte'] > 65535 or tk['x_tile_size_byte'] > 65535:
+        print("  Fused layer: transfers bigger than 64 KiB are not supported. Exiting...")
+        os._exit(0)
+    # l1 parameters
+    if tk['tile_dim_h'] == 1:
+        x_buffer_size = tk['x_tile_size_byte']
+        y_buffer_size = tk['y_tile_size_byte']
+    else:
+        x_buffer_size = 2 * tk['x_tile_size_byte']
+        y_buffer_size = 2 * tk['y_tile_size_byte']
+    tk['l1_x_offset'] = 0
+    tk['l1_x_dw_offset'] = align(x_buffer_size + 4)
+    tk['l1_y_offset'] = align(tk['l1_x_dw_offset'] + n_in * tile_h_out * w_out + 4)
+    tk['l1_W_dw_offset'] = align(tk['l1_y_offset'] + y_buffer_size + 4)
+    tk['l1_W_pw_offset'] = align(tk['l1_W_dw_offset'] + tk['W_dw_size_byte'] + 4)
+    tk['l1_k_dw_offset'] = align(tk['l1_W_pw_offset'] + tk['W_pw_size_byte'] + 4)
+    tk['l1_lambda_dw_offset'] = tk['l1_k_dw_offset'] + tk['k_dw_size_byte']
+    tk['l1_k_pw_offset'] = tk['l1_lambda_dw_offset'] + tk['k_dw_size_byte']
+    tk['l1_lambda_pw_offset'] = tk['l1_k_pw_offset'] + tk['k_pw_size_byte']
+    buffer_l1_all = tk['l1_lambda_pw_offset'] + tk['k_pw_size_byte'] + 4
+    tk['buffer_l1_all'] = buffer_l1_all
+    tk['im2col_dim'] = 8 * (fs1 * (tile_h_in + 2 * padding_top) + fs1)
+    l = ""
+    for k, v in tk.items():
+        try:
+            l += "// %s %d\n" % (k.ljust(30), v)
+        except TypeError:
+            l += "// %s %s\n" % (k.ljust(30), v)
+    root = '/'.join(os.getcwd().split('/')[:-1])
+    tmpl = Template(filename=root+"/templates/layer_templates/layer_template_fused.c")
+    s = tmpl.render(TEST=False,VERBOSE=False,ULTRA_VERBOSE=ultra_verbose,PULP_TEST=True,verbose_log=l,**tk)
+    save_string = './application/DORY_network/src/' + name_layer.replace("h", "c")
+    with open(save_string, "w") as f:
+        f.write(s)
+    tmpl = Template(filename=root+"/templates/layer_templates/layer_template_h.h")
+    s = tmpl.render(TEST=False,VERBOSE=False,ULTRA_VERBOSE=ultra_verbose,PULP_TEST=True,verbose_log=l,**tk)
+    save_string = './application/DORY_network/inc/' + name_layer
+    with open(save_string, "w") as f:
+        f.write(s)
+    l2_dim_input = n_in * h_in * w_in
+    l2_dim_output = n_out * h_out * w_out
+    return l2_dim_input, l2_dim_output, l2_dim_weights, buffer_l1_all + tk['im2col_dim']
+
+
 def print_test_vector(x, type_data):
     # Print the test vector in the c file.
     if type_data == 'char':
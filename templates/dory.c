@@ -175,6 +175,162 @@ unsigned int  dory_get_tile_4d(
 }
 
 #define MIN(a,b) ((a)<(b)?(a):(b))
+// largest transfer of a single command, a multiple of 4 bytes
+#define DORY_DMA_MAX_SIZE 65532
+// smaller 3d copies are issued by core 0 alone: splitting them would cost more commands than it saves
+#ifndef DORY_DMA_PARALLEL_SIZE
+#define DORY_DMA_PARALLEL_SIZE (NUM_CORES * 128)
+#endif
+
+// range [start, stop) of the units (pixels or channels) of a copy of size bytes issued by this core.
+// The units are balanced among the cores, with a difference of one unit at most. The core count is a
+// compile-time constant, so that the divisions are shifts.
+static inline void dory_dma_core_range(
+  int units,
+  unsigned int size,
+  int *start,
+  int *stop
+)
+{
+  int core_id = pi_core_id();
+% if dma_parallelization == '8-cores':
+  if (size >= DORY_DMA_PARALLEL_SIZE)
+  {
+    int chunk = units / NUM_CORES;
+    int rest = units % NUM_CORES;
+    *start = core_id * chunk + MIN(core_id, rest);
+    *stop = *start + chunk + (core_id < rest);
+    return;
+  }
+% endif
+  *start = 0;
+  *stop = core_id == 0 ? units : 0;
+}
+
+// one row of a 3d copy: length_1 chunks of length_0 bytes, stride_0 bytes apart in ext and contiguous in loc.
+// A single 1d transfer if the chunks are contiguous also in ext (the tile spans all the channels), a 2d one otherwise.
+static inline void dory_dma_row(
+  unsigned int ext,
+  unsigned int loc,
+  unsigned short length_1,
+  unsigned short length_0,
+  unsigned short stride_0,
+  unsigned int dir
+)
+{
+  if (length_0 == stride_0 || length_1 == 1)
+  {
+#if (MCHAN_VERSION < 7)
+    mchan_transfer(length_0*length_1, dir, 1, 0, 1, 0, 0, ext, loc, 0, 0);
+#elif (MCHAN_VERSION == 7)
+    mchan_transfer(length_0*length_1, dir, 1, 0, 0, 1, 0, 0, ext, loc, 0, 0, 0, 0);
+#endif
+  }
+  else
+  {
+#if (MCHAN_VERSION < 7)
+    mchan_transfer(length_0*length_1, dir, 1, 1, 1, 0, 0, ext, loc, length_0, stride_0);
+#elif (MCHAN_VERSION == 7)
+    mchan_transfer(length_0*length_1, dir, 1, 1, 0, 1, 0, 0, ext, loc, length_0, stride_0, 0, 0);
+#endif
+  }
+}
+
+// pixels [start, stop) of a 3d copy with length_1 pixels per row: one dory_dma_row for each row, or part of a row, in the range
+static inline void dory_dma_rows(
+  unsigned int ext,
+  unsigned int loc,
+  int start,
+  int stop,
+  unsigned short length_1,
+  unsigned short length_0,
+  unsigned short stride_1,
+  unsigned short stride_0,
+  unsigned int dir
+)
+{
+  if (start >= stop)
+    return;
+  int i = start / length_1;
+  int j = start - i*length_1;
+  while (start < stop)
+  {
+    int n = MIN(length_1 - j, stop - start);
+% if chip == 'GAP8v2':
+    // alloc channels with barrier after if we consider v2 chips, with DMA issue 
+    int dma_evt = mchan_alloc();
+% endif
+    dory_dma_row(ext + i*stride_1 + j*stride_0, loc + start*length_0, n, length_0, stride_0, dir);
+% if chip == 'GAP8v2':
+    mchan_barrier(dma_evt);
+    mchan_free(dma_evt);
+% endif
+    start += n;
+    i++;
+    j = 0;
+  }
+}
+
+// tile contiguous also in ext (all the channels and the whole width, detected by template.py): the 3d copy is
+// merged in a single transfer by core 0, split only at the 16 bits size of a command.
+void __attribute__ ((noinline)) dory_dma_memcpy_1d(
+  unsigned int ext,
+  unsigned int loc,
+  unsigned int size,
+  unsigned int dir
+)
+{
+  if (pi_core_id()==0)
+  {
+    while (size > 0)
+    {
+      unsigned short length = MIN(size, DORY_DMA_MAX_SIZE);
+% if chip == 'GAP8v2':
+      // alloc channels with barrier after if we consider v2 chips, with DMA issue 
+      int dma_evt = mchan_alloc();
+% endif
+#if (MCHAN_VERSION < 7)
+      mchan_transfer(length, dir, 1, 0, 1, 0, 0, ext, loc, 0, 0);
+#elif (MCHAN_VERSION == 7)
+      mchan_transfer(length, dir, 1, 0, 0, 1, 0, 0, ext, loc, 0, 0, 0, 0);
+#endif
+% if chip == 'GAP8v2':
+      mchan_barrier(dma_evt);
+      mchan_free(dma_evt);
+% endif
+      ext += length;
+      loc += length;
+      size -= length;
+    }
+  }
+}
+
+void __attribute__ ((noinline)) dory_dma_memcpy_1d_blocking(
+  unsigned int ext,
+  unsigned int loc,
+  unsigned int size,
+  unsigned int dir
+)
+{
+  if (pi_core_id()==0)
+  {
+    int dma_evt = mchan_alloc();
+    while (size > 0)
+    {
+      unsigned short length = MIN(size, DORY_DMA_MAX_SIZE);
+#if (MCHAN_VERSION < 7)
+      mchan_transfer(length, dir, 1, 0, 1, 0, 0, ext, loc, 0, 0);
+#elif (MCHAN_VERSION == 7)
+      mchan_transfer(length, dir, 1, 0, 0, 1, 0, 0, ext, loc, 0, 0, 0, 0);
+#endif
+      ext += length;
+      loc += length;
+      size -= length;
+    }
+    mchan_barrier(dma_evt);
+    mchan_free(dma_evt);
+  }
+}
 
 void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_weights(
   unsigned int ext,
@@ -190,11 +346,24 @@ void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_weights(
 {
   // parallelization
   if (pi_core_id()==0)
+  {
+    if (length_0 == stride_0)
+    {
+      // all the input channels: the tile is contiguous
 #if (MCHAN_VERSION < 7)
-    mchan_transfer(size, dir, 1, 0, 1, 0, 0, (unsigned int)(ext), (unsigned int)(loc), 0, 0);
+      mchan_transfer(size, dir, 1, 0, 1, 0, 0, (unsigned int)(ext), (unsigned int)(loc), 0, 0);
 #elif (MCHAN_VERSION == 7)
-    mchan_transfer(size, dir, 1, 0, 0, 1, 0, 0, (unsigned int)(ext), (unsigned int)(loc), 0, 0, 0, 0);
+      mchan_transfer(size, dir, 1, 0, 0, 1, 0, 0, (unsigned int)(ext), (unsigned int)(loc), 0, 0, 0, 0);
 #endif
+    }
+    else
+    {
+      // tile along the input channels: a 2d copy for each output channel
+      unsigned short length_1 = size / (length_2*length_0);
+      for ( int i=0; i<length_2; i++) 
+        dory_dma_row(ext + i*stride_1, loc + i*length_0*length_1, length_1, length_0, stride_0, dir);
+    }
+  }
 }
 
 void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_out(
@@ -209,37 +378,14 @@ void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_out(
   unsigned int *id
 ) 
 {
-  // parallelization
-  int core_id = pi_core_id();
-  int Log2Core = log2(NUM_CORES);
-% if dma_parallelization == '8-cores':
-  int chunk = (length_2 >> Log2Core) + ((length_2 & (NUM_CORES-1))!=0);
-% elif dma_parallelization == '1-core':
-  int chunk = length_2;
-% endif
+  // parallelization: each core copies a balanced range of the pixels of the tile
   unsigned short length_1 = size / (length_2*length_0);
   int start_pixel, stop_pixel;
-  start_pixel = MIN(chunk * core_id, length_2);
-  stop_pixel = MIN(start_pixel+chunk, length_2);
-  int offs_remote = stride_1*start_pixel;
-  int offs_local = length_0*length_1*start_pixel;
-  for ( int i=start_pixel; i<stop_pixel; i++) 
-  {
-    for ( int j=0; j<length_1; j++) 
-    {
-#if (MCHAN_VERSION < 7)
-      mchan_transfer(length_0, dir, 1, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 0, 0);
-#elif (MCHAN_VERSION == 7)
-      mchan_transfer(length_0, dir, 1, 0, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 0, 0, 0, 0);
-#endif
-      offs_local  += length_0;
-      offs_remote += stride_0;
-    }
-    offs_remote = offs_remote - stride_0*length_1 + stride_1;
-  }
+  dory_dma_core_range(length_2*length_1, size, &start_pixel, &stop_pixel);
+  dory_dma_rows(ext, loc, start_pixel, stop_pixel, length_1, length_0, stride_1, stride_0, dir);
 }
 
-// copies are managed by 8 cores parallely. By now, 3d copies are a serie of 1d copy. In future, will be a serie of 2d copies.
+// copies are managed by the cores parallely, balanced by pixels. 3d copies are a serie of 2d copies, one for each row of the tile.
 void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom(
   unsigned int ext,
   unsigned int loc,
@@ -252,38 +398,11 @@ void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom(
   unsigned int *id
 ) 
 {
-  // parallelization
-  int core_id = pi_core_id();
-  int Log2Core = log2(NUM_CORES);
-% if dma_parallelization == '8-cores':
-  int chunk = (length_2 >> Log2Core) + ((length_2 & (NUM_CORES-1))!=0);
-% elif dma_parallelization == '1-core':
-  int chunk = length_2;
-% endif
+  // parallelization: each core copies a balanced range of the pixels of the tile
   unsigned short length_1 = size / (length_2*length_0);
   int start_pixel, stop_pixel;
-  start_pixel = MIN(chunk * core_id, length_2);
-  stop_pixel = MIN(start_pixel+chunk, length_2);
-  int offs_remote = stride_1*start_pixel;
-  int offs_local = length_0*length_1*start_pixel;
-  for ( int i=start_pixel; i<stop_pixel; i++) 
-  {
-% if chip == 'GAP8v2':
-    // alloc channels with barrier after if we consider v2 chips, with DMA issue 
-    int dma_evt = mchan_alloc();
-% endif
-#if (MCHAN_VERSION < 7)
-    mchan_transfer(length_0*length_1, dir, 1, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 0, 0);
-#elif (MCHAN_VERSION == 7)
-    mchan_transfer(length_0*length_1, dir, 1, 0, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 0, 0, 0, 0);
-#endif
-% if chip == 'GAP8v2':
-    mchan_barrier(dma_evt);
-    mchan_free(dma_evt);
-% endif
-    offs_local  += length_0*length_1;
-    offs_remote = offs_remote + stride_1;
-  }
+  dory_dma_core_range(length_2*length_1, size, &start_pixel, &stop_pixel);
+  dory_dma_rows(ext, loc, start_pixel, stop_pixel, length_1, length_0, stride_1, stride_0, dir);
 }
 
 void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_blocking(
@@ -298,36 +417,12 @@ void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_blocking(
   unsigned int *id
 ) 
 {
-  // parallelization
-  int core_id = pi_core_id();
-  int Log2Core = log2(NUM_CORES);
-% if dma_parallelization == '8-cores':
-  int chunk = (length_2 >> Log2Core) + ((length_2 & (NUM_CORES-1))!=0);
-% elif dma_parallelization == '1-core':
-  int chunk = length_2;
-% endif
+  // parallelization: each core copies a balanced range of the pixels of the tile
   unsigned short length_1 = size / (length_2*length_0);
   int start_pixel, stop_pixel;
-  start_pixel = MIN(chunk * core_id, length_2);
-  stop_pixel = MIN(start_pixel+chunk, length_2);
-  int offs_remote = stride_1*start_pixel;
-  int offs_local = length_0*length_1*start_pixel;
+  dory_dma_core_range(length_2*length_1, size, &start_pixel, &stop_pixel);
   int dma_evt = mchan_alloc();
-  for ( int i=start_pixel; i<stop_pixel; i++) 
-  {
-    for ( int j=0; j<length_1; j++) 
-    {
-      // alloc channels with barrier after if we consider v2 chips, with DMA issue 
-#if (MCHAN_VERSION < 7)
-      mchan_transfer(length_0, dir, 1, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 0, 0);
-#elif (MCHAN_VERSION == 7)
-      mchan_transfer(length_0, dir, 1, 0, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 0, 0, 0, 0);
-#endif
-      offs_local  += length_0;
-      offs_remote += stride_0;
-    }
-    offs_remote = offs_remote - stride_0*length_1 + stride_1;
-  }
+  dory_dma_rows(ext, loc, start_pixel, stop_pixel, length_1, length_0, stride_1, stride_0, dir);
   mchan_barrier(dma_evt);
   mchan_free(dma_evt);
 }
@@ -344,30 +439,98 @@ void __attribute__ ((noinline)) dory_dma_memcpy_3d_custom_hwc_to_chw(
   unsigned int dir,
   unsigned int *id
 ) {
-  int core_id = pi_core_id();
-  int Log2Core = log2(NUM_CORES);
-% if dma_parallelization == '8-cores':
-  int chunk = (length_0 >> Log2Core) + ((length_0 & (NUM_CORES-1))!=0);
-% elif dma_parallelization == '1-core':
-  int chunk = length_0;
-% endif
+  // parallelization: each core copies a balanced range of the channels of the tile
   unsigned short length_1 = size / (length_2*length_0);
   int start_pixel, stop_pixel;
-  start_pixel = MIN(chunk * core_id, length_0);
-  stop_pixel = MIN(start_pixel+chunk, length_0);
+  dory_dma_core_range(length_0, size, &start_pixel, &stop_pixel);
   int offs_remote = start_pixel;
   int offs_local = length_2*length_1*start_pixel;
   int dma_evt = mchan_alloc();
   for ( int i=start_pixel; i<stop_pixel; i++) 
   {
+    if (length_1*stride_0 == stride_1)
+    {
+      // the tile spans the whole row: the channel is a single strided transfer
 #if (MCHAN_VERSION < 7)
-    mchan_transfer(length_1*length_2, dir, 1, 1, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 1, stride_0);
+      mchan_transfer(length_1*length_2, dir, 1, 1, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 1, stride_0);
 #elif (MCHAN_VERSION == 7)
-    mchan_transfer(length_1*length_2, dir, 1, 1, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 1, stride_0, 0, 0);
+      mchan_transfer(length_1*length_2, dir, 1, 1, 0, 1, 0, 0, (unsigned int)(ext + offs_remote), (unsigned int)(loc + offs_local), 1, stride_0, 0, 0);
 #endif
-    mchan_barrier(dma_evt);
+      mchan_barrier(dma_evt);
+    }
+    else
+    {
+      // tile along w: one strided transfer per row, rows are stride_1 apart in L2
+      for ( int j=0; j<length_2; j++) 
+      {
+#if (MCHAN_VERSION < 7)
+        mchan_transfer(length_1, dir, 1, 1, 1, 0, 0, (unsigned int)(ext + offs_remote + j*stride_1), (unsigned int)(loc + offs_local + j*length_1), 1, stride_0);
+#elif (MCHAN_VERSION == 7)
+        mchan_transfer(length_1, dir, 1, 1, 0, 1, 0, 0, (unsigned int)(ext + offs_remote + j*stride_1), (unsigned int)(loc + offs_local + j*length_1), 1, stride_0, 0, 0);
+#endif
+        mchan_barrier(dma_evt);
+      }
+    }
     offs_local  += length_1*length_2;
     offs_remote = offs_remote + 1;
   }
   mchan_free(dma_evt);
+}
+
+typedef unsigned char dory_v4u __attribute__((vector_size (4)));
+
+// transposition of an 8 bits tile from HWC to CHW, in L1, by all the cores. Each core transposes a group of channels.
+// When channels and the two buffers are aligned to 4 bytes, blocks of 4 pixels x 4 channels are read with 32 bits
+// accesses and transposed with shuffles, and the last pixels & 3 pixels byte by byte: the rows of the output are then
+// misaligned if pixels is not a multiple of 4, which costs an extra cycle per store. Otherwise the tile is transposed
+// byte by byte.
+void __attribute__ ((noinline)) dory_hwc_to_chw(
+  unsigned int src,
+  unsigned int dst,
+  unsigned short pixels,
+  unsigned short channels
+) {
+  int core_id = pi_core_id();
+  unsigned char *in = (unsigned char *) src;
+  unsigned char *out = (unsigned char *) dst;
+  int quads = ((channels & 3) == 0 && ((src | dst) & 3) == 0) ? channels >> 2 : 0;
+  int pixels_simd = pixels & ~3;
+  int chunk = (quads + NUM_CORES - 1) / NUM_CORES;
+  int start_quad = MIN(chunk * core_id, quads);
+  int stop_quad = MIN(start_quad + chunk, quads);
+  for (int c = start_quad << 2; c < stop_quad << 2; c += 4)
+  {
+    for (int p = 0; p < pixels_simd; p += 4)
+    {
+      dory_v4u a = *((dory_v4u *) (in + p*channels + c));
+      dory_v4u b = *((dory_v4u *) (in + (p+1)*channels + c));
+      dory_v4u d = *((dory_v4u *) (in + (p+2)*channels + c));
+      dory_v4u e = *((dory_v4u *) (in + (p+3)*channels + c));
+      dory_v4u ab_lo = __builtin_shuffle(a, b, (dory_v4u) {0, 4, 1, 5});
+      dory_v4u ab_hi = __builtin_shuffle(a, b, (dory_v4u) {2, 6, 3, 7});
+      dory_v4u de_lo = __builtin_shuffle(d, e, (dory_v4u) {0, 4, 1, 5});
+      dory_v4u de_hi = __builtin_shuffle(d, e, (dory_v4u) {2, 6, 3, 7});
+      *((dory_v4u *) (out + c*pixels + p)) = __builtin_shuffle(ab_lo, de_lo, (dory_v4u) {0, 1, 4, 5});
+      *((dory_v4u *) (out + (c+1)*pixels + p)) = __builtin_shuffle(ab_lo, de_lo, (dory_v4u) {2, 3, 6, 7});
+      *((dory_v4u *) (out + (c+2)*pixels + p)) = __builtin_shuffle(ab_hi, de_hi, (dory_v4u) {0, 1, 4, 5});
+      *((dory_v4u *) (out + (c+3)*pixels + p)) = __builtin_shuffle(ab_hi, de_hi, (dory_v4u) {2, 3, 6, 7});
+    }
+    for (int p = pixels_simd; p < pixels; p++)
+    {
+      out[c*pixels + p] = in[p*channels + c];
+      out[(c+1)*pixels + p] = in[p*channels + c + 1];
+      out[(c+2)*pixels + p] = in[p*channels + c + 2];
+      out[(c+3)*pixels + p] = in[p*channels + c + 3];
+    }
+  }
+  if (quads == 0)
+  {
+    // odd sizes: a channel per core at a time
+    chunk = (channels + NUM_CORES - 1) / NUM_CORES;
+    int start_channel = MIN(chunk * core_id, channels);
+    int stop_channel = MIN(start_channel + chunk, channels);
+    for (int c = start_channel; c < stop_channel; c++)
+      for (int p = 0; p < pixels; p++)
+        out[c*pixels + p] = in[p*channels + c];
+  }
 }
\ No newline at end of file
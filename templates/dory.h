@@ -21,6 +21,44 @@
 % if sdk == 'gap_sdk':
 #include "pulp.h"
 % endif
+
+#ifndef DORY_TILE_TYPES
+#define DORY_TILE_TYPES
+// copy of a tile, generated by template.py: ext is the offset from the tensor in L2, loc the offset from the
+// L1 buffer. 3d copies are length_2 rows of length_0 bytes, with the strides of the layer. size is 0 when the
+// tile does not need the copy (same weights of the previous tile, output of a partial tile).
+typedef struct {
+  unsigned int ext;
+  unsigned int loc;
+  unsigned short size;
+  unsigned short length_2;
+  unsigned short length_0;
+} dory_dma_descriptor_t;
+
+// copies of a tile of the tile loop. act is the copy of k, and of lambda at the same offsets.
+typedef struct {
+  dory_dma_descriptor_t x;
+  dory_dma_descriptor_t W;
+  dory_dma_descriptor_t act;
+  dory_dma_descriptor_t y;
+} dory_tile_dma_t;
+
+// kernel arguments of a tile of the tile loop
+typedef struct {
+  unsigned short x_tile_size_nif;
+  unsigned short x_tile_size_h;
+  unsigned short x_tile_size_w;
+  unsigned short y_tile_size_nof;
+  unsigned short y_tile_size_h;
+  unsigned short y_tile_size_w;
+  unsigned short b_loc;
+  unsigned char p_t;
+  unsigned char p_b;
+  unsigned char p_l;
+  unsigned char p_r;
+} dory_tile_args_t;
+#endif
+
 unsigned int dory_get_tile_1d(
   unsigned x,
   int tile_ii,
@@ -75,6 +113,20 @@ unsigned int dory_get_tile_4d(
   int data_size
 );
 
+void dory_dma_memcpy_1d(
+  unsigned int ext,
+  unsigned int loc,
+  unsigned int size,
+  unsigned int dir
+);
+
+void dory_dma_memcpy_1d_blocking(
+  unsigned int ext,
+  unsigned int loc,
+  unsigned int size,
+  unsigned int dir
+);
+
 void dory_dma_memcpy_3d_custom(
   unsigned int ext,
   unsigned int loc,
@@ -97,4 +149,11 @@ void dory_dma_memcpy_3d_custom_hwc_to_chw(
   unsigned short length_0,
   unsigned int dir,
   unsigned int *id
+);
+
+void dory_hwc_to_chw(
+  unsigned int src,
+  unsigned int dst,
+  unsigned short pixels,
+  unsigned short channels
 );
\ No newline at end of file
@@ -20,6 +20,7 @@
 ${verbose_log}
 
 #include "${func_name}.h"
+#include "mem_controller.h"
 % if ULTRA_VERBOSE:
 #define VERBOSE_PRINT(...) printf(__VA_ARGS__)
 % endif
@@ -84,6 +85,10 @@ void ${func_name}(
 
   int exec_db_x;
   int exec_db_W;
+#ifdef MEMORY_STATISTICS
+  if (pi_core_id()==0)
+    dory_L1_used(${buffer_l1_all});
+#endif
   % if chip == 'GAP8v3':
 % if dma_parallelization == '1-core':
   if (pi_core_id()==0)
@@ -19,10 +19,23 @@
  */
 
 #include "${func_name}.h"
+#include "mem_controller.h"
 % if ULTRA_VERBOSE:
 #define VERBOSE_PRINT(...) printf(__VA_ARGS__)
 % endif
 
+// copies and kernel arguments of the tiles of the tile loop, in loop order (generated by template.py)
+static const dory_tile_dma_t ${func_name}_tiles_dma[${len(tiles_dma)}] = {
+% for tile in tiles_dma:
+  {${', '.join('{' + ', '.join(str(v) for v in copy) + '}' for copy in tile)}},
+% endfor
+};
+static const dory_tile_args_t ${func_name}_tiles_args[${len(tiles_args)}] = {
+% for args in tiles_args:
+  {${', '.join(str(v) for v in args)}},
+% endfor
+};
+
 void ${func_name}(
   void *args
 ) {
@@ -48,19 +61,7 @@ void ${func_name}(
   // Variable declaration //
   //////////////////////////
   unsigned int dma_evt;
-  volatile int p_r, p_l, p_t, p_b;
-% if tile_dim_nif*tile_dim_h*tile_dim_w != 1:
-  volatile  unsigned short x_tile_size_nif;
-  volatile unsigned short  x_tile_size_h;
-  volatile unsigned short  x_tile_size_w;
-  volatile unsigned short  x_tile_size_byte;
-  volatile unsigned short  x_length_nif_byte;
-  volatile int pad_offset_h, pad_offset_w;
-% endif  
-  volatile unsigned short  W_tile_size_nof;
-  volatile unsigned short  W_tile_size_nif;
-  volatile unsigned short  W_tile_size_byte;
-  volatile unsigned short W_length_nif_byte;
+  int p_r, p_l, p_t, p_b;
   volatile ${type} *x;
   volatile ${type} *W;
   volatile ${type} *y;
@@ -74,32 +75,26 @@ void ${func_name}(
   volatile int64_t *lambda;
 % endif
 % endif
-  volatile int x_tile_size_nif_exec;
-  volatile int x_tile_size_h_exec;
-  volatile int x_tile_size_w_exec;
-  volatile int y_tile_size_nof;
-  volatile int y_tile_size_h;
-  volatile int y_tile_size_w;
-  volatile int y_tile_size_byte;
-  volatile int y_length_nof_byte;
-  volatile int db_x;
-  volatile int db_W;
-  volatile int db_act;
-  volatile int db_y;
-  volatile int exec_db_x;
-  volatile int exec_db_W;
-  volatile int exec_db_act;
+  int x_tile_size_nif_exec;
+  int x_tile_size_h_exec;
+  int x_tile_size_w_exec;
+  int y_tile_size_nof;
+  int y_tile_size_h;
+  int y_tile_size_w;
   volatile pi_cl_dma_copy_t copy_k;
   volatile pi_cl_dma_copy_t copy_lambda;
-  // double buffering state
-  int db_state_x=0;
-  int db_state_W=0;
-  int db_state_y=1;
-  // last-tile flags
+% if n_buffers > 2:
+  // ring of ${n_buffers} L1 buffers: tile iter+${n_buffers-1} is loaded while tile iter is computed.
+  // One mchan transfer id per tile in flight.
+  int dma_evt_slot=1;
+  unsigned int dma_evt_ring[${n_buffers-1}];
+% endif
   int iter;
-  // tile loop indeces
-  int _i_nof_load=0, _i_nif_load=0, _i_h_load=0, _i_w_load=0;
-  int _i_nof_exec=0, _i_nif_exec=0, _i_h_exec=0, _i_w_exec=0;
+  // descriptors of the tile being loaded and of the tile being computed. The L1 offsets include the slot
+  // of the tile in the buffers.
+  const dory_tile_dma_t *tile_load;
+  const dory_tile_dma_t *tile_exec;
+  const dory_tile_args_t *tile_args;
 % if has_bias == 1:
   int has_bias = ${has_bias};
 % endif
@@ -109,6 +104,10 @@ void ${func_name}(
   volatile ${type} *pwt_buffer;
   pwt_buffer = im2col + ${im2col_dim};
 % endif
+#ifdef MEMORY_STATISTICS
+  if (pi_core_id()==0)
+    dory_L1_used(${buffer_l1_all + l1_scratch_size});
+#endif
 % if FLAG_RELU == 1:
   uint16_t out_mult = out_mult_in;
   uint16_t out_shift = out_shift_in;
@@ -133,16 +132,17 @@ void ${func_name}(
 % if FLAG_BATCHNORM == 1:
   if(pi_core_id()==0)
   {
+    // k and lambda of ${'the whole layer' if BN_whole == 1 else 'the first tile'}
     copy_k.dir = PI_CL_DMA_DIR_EXT2LOC;
     copy_k.merge = 0;
-    copy_k.size = (uint16_t) ${k_tile_size_byte_transfer};
+    copy_k.size = (uint16_t) ${k_size_byte if BN_whole == 1 else k_tile_size_byte_transfer};
     copy_k.id = 0;
     copy_k.ext = (uint32_t) l2_W+${l2_off_k};
     copy_k.loc = (uint32_t) l1_buffer + ${l1_k_offset};
     pi_cl_dma_memcpy(&copy_k);   
     copy_lambda.dir = PI_CL_DMA_DIR_EXT2LOC;
     copy_lambda.merge = 0;
-    copy_lambda.size = (uint16_t) ${lambda_tile_size_byte_transfer};
+    copy_lambda.size = (uint16_t) ${lambda_size_byte if BN_whole == 1 else lambda_tile_size_byte_transfer};
     copy_lambda.id = 0;
     copy_lambda.ext = (uint32_t) l2_W+${l2_off_lambda};
     copy_lambda.loc = (uint32_t) l1_buffer + ${l1_lambda_offset};
@@ -170,7 +170,19 @@ void ${func_name}(
   if (pi_core_id()==0)
   {
 % endif
-  % if flag_DW == 1:
+  % if x_contiguous == 1:
+  // the input tile is contiguous in L2: a single transfer${', transposed by the cores before the kernel' if hwc_to_chw_L1 == 1 else ''}
+  dory_dma_memcpy_1d${'_blocking' if flag_DW == 1 else ''}(
+  l2_x, // ext
+  (l1_buffer + ${l1_x_offset}) + 0, // loc
+  ${x_tile_size_byte}, // size
+  1 // dir
+  );
+  % else:
+  % if flag_DW == 1 and hwc_to_chw_L1 == 1:
+  // HWC copy of the input tile, transposed by the cores before the kernel
+  dory_dma_memcpy_3d_custom_blocking(
+  % elif flag_DW == 1:
   dory_dma_memcpy_3d_custom_hwc_to_chw(
   % else:
   dory_dma_memcpy_3d_custom(
@@ -185,11 +197,17 @@ void ${func_name}(
   1, // dir
   &dma_evt // copy
   );
-  % if flag_DW == 1:
-  dory_dma_memcpy_3d_custom_blocking(
+  % endif
+  % if W_contiguous == 1:
+  // the weight tile is contiguous in L2: a single transfer
+  dory_dma_memcpy_1d${'_blocking' if flag_DW == 1 else ''}(
+  l2_W, // ext
+  (l1_buffer + ${l1_W_offset}) + 0, // loc
+  ${W_tile_size_byte}, // size
+  1 // dir
+  );
   % else:
   dory_dma_memcpy_3d_custom(
-  % endif
   l2_W, // ext
   (l1_buffer + ${l1_W_offset}) + 0, // loc offset caused by size of tile_x*2 (double_buffer) and tile_y*2 (double buffer)
   ${W_tile_size_byte}, // size: dimension of matrix of weight * bytes_per_weight
@@ -200,228 +218,174 @@ void ${func_name}(
   1, // dir
   &dma_evt // copy
   );
+  % endif
   % if chip == 'GAP8v3':
   mchan_barrier(dma_evt);
   % endif
+  % if n_buffers > 2:
+  // from now on, every tile in flight has its own transfer id
+  mchan_free(dma_evt);
+  dma_evt_ring[dma_evt_slot] = mchan_alloc();
+  % endif
 % if dma_parallelization == '1-core':
   }
 % endif
   pi_cl_team_barrier(0);
 
 
-  // tile loop nest
-% if flag_DW == 0:
-  for(iter=0; iter<${tile_dim_nof}*${tile_dim_nif}*${tile_dim_h}*${tile_dim_w}; iter++) {
-% else:
-  for(iter=0; iter<${tile_dim_nof}*${tile_dim_h}*${tile_dim_w}; iter++) {
-% endif
-  % if tile_dim_nif != 1 and flag_DW == 0:
-    // loop nest is nof,h,w,nif
-    _i_nif_load += 1;
-    if(_i_nif_load==${tile_dim_nif}) 
-    {
-      _i_nif_load = 0;
-      _i_w_load += 1;
-      if(_i_w_load==${tile_dim_w}) 
-      {
-        _i_w_load = 0;
-        _i_h_load += 1;
-        if(_i_h_load==${tile_dim_h}) 
-        {
-          _i_h_load = 0;
-          _i_nof_load += 1;
-        }
-      }
-    }
-  % else:
-    // loop nest is nof,h,w,(nif=0)
-    _i_w_load += 1;
-    if(_i_w_load==${tile_dim_w}) 
-    {
-      _i_w_load = 0;
-      _i_h_load += 1;
-      if(_i_h_load==${tile_dim_h}) 
-      {
-        _i_h_load = 0;
-      % if flag_DW == 1:
-        _i_nif_load += 1;
-      % endif
-        _i_nof_load += 1;
-      }
-    }
-  % endif
-    // check if last in any dimension
-
-    // compute double buffering offsets and update db state
-    db_x = !db_state_x ? ${x_tile_size_byte} : 0;
-    db_W = !db_state_W ? ${W_tile_size_byte} : 0;
-    db_y = !db_state_y ? ${y_tile_size_byte} : 0;
-% if FLAG_BATCHNORM == 1:
-    db_act = !db_state_W ? ${k_tile_size_byte_transfer} : 0;
-% endif
-  % if tile_dim_nif*tile_dim_h*tile_dim_w != 1:
-    exec_db_x = db_state_x ? ${x_tile_size_byte} : 0;
-  % else:
-    exec_db_x = 0;
-  % endif
-    db_state_x = ! db_state_x;
-    exec_db_W = db_state_W ? ${W_tile_size_byte} : 0;
-% if FLAG_BATCHNORM == 1:
-    exec_db_act = db_state_W ? ${k_tile_size_byte_transfer} : 0;
-% endif
-    if (_i_nif_load!=_i_nif_exec || _i_nof_load!=_i_nof_exec)
-      db_state_W = ! db_state_W;
-    //switch all double buffering offset and y only after that all n_input_features have been analyzed: we need to pass all n_in to produce a single fil
-///////// POSSIBLE BUG FIX!!!!! DB_STATE_Y NOT SWITCHED /////////////
-
+  // tile loop over the tables${'. Iterations with iter < 0 only fill the ring of buffers' if n_buffers > 2 else ''}
+  for(iter=${2-n_buffers}; iter<${len(tiles_dma)}; iter++) {
     // double buffered reads
-  % if flag_DW == 0:
-    if(iter<${tile_dim_nof}*${tile_dim_nif}*${tile_dim_h}*${tile_dim_w}-1) 
-    {
-  % else:
-    if(iter<${tile_dim_nof}*${tile_dim_h}*${tile_dim_w}-1) 
+    if(iter<${len(tiles_dma)-(n_buffers-1)}) 
     {
+  % if flag_DW == 1:
       asm volatile("": : :"memory");
   % endif
-    % if tile_dim_nif*tile_dim_h*tile_dim_w != 1:
-      x_tile_size_nif = (_i_nif_load+1 == ${tile_dim_nif}) ? ${x_tile_size_nif_last} : ${x_tile_size_nif};
-      x_tile_size_h   = (_i_h_load+1 == ${tile_dim_h})   ? ${x_tile_size_h_last} : ${x_tile_size_h};
-      x_tile_size_w   = (_i_w_load+1 == ${tile_dim_w})   ? ${x_tile_size_w_last} : ${x_tile_size_w};
-      x_tile_size_byte = x_tile_size_nif*x_tile_size_h*x_tile_size_w*${x_data_size_byte}/8;
-      x_length_nif_byte = (_i_nif_load+1 == ${tile_dim_nif})   ? ${x_tile_size_nif_byte_last} : ${x_tile_size_nif_byte};
-      // additionally overlap by padding for the first tile after a border one
-      //this because in the first tile we use less pixels from x_buffer, since we have the ones of padding
-      pad_offset_h=0, pad_offset_w=0;
-      if(_i_h_load > 0)
-        pad_offset_h = ${padding_top};
-      if(_i_w_load > 0)
-        pad_offset_w = ${padding_left};
-    % endif
-      y_tile_size_h   = (_i_h_load+1 == ${tile_dim_h})   ? ${y_tile_size_h_last} : ${y_tile_size_h};
-      y_tile_size_w   = (_i_w_load+1 == ${tile_dim_w})   ? ${y_tile_size_w_last} : ${y_tile_size_w};
-      W_tile_size_nof = (_i_nof_load+1 == ${tile_dim_nof}) ? ${W_tile_size_nof_last} : ${W_tile_size_nof};
-      W_tile_size_nif = (_i_nif_load+1 == ${tile_dim_nif}) ? ${W_tile_size_nif_last} : ${W_tile_size_nif};
-    % if flag_DW == 1:
-      W_tile_size_byte = W_tile_size_nof*W_tile_size_nif*${fs1}*${fs2};
-    % else:
-      W_tile_size_byte = W_tile_size_nof*W_tile_size_nif*${W_data_size_byte}*${fs1}*${fs2}/8;
-    % endif
-      W_length_nif_byte = (_i_nif_load+1 == ${tile_dim_nif}) ? ${W_tile_size_nif_byte_last} : ${W_tile_nif_byte};
+      tile_load = &${func_name}_tiles_dma[iter+${n_buffers-1}];
     // transfer of next input tile in double buffering
     % if tile_dim_nif*tile_dim_h*tile_dim_w != 1:
 % if dma_parallelization == '1-core':
       if (pi_core_id()==0)
       {
 % endif
-    % if flag_DW == 1:
+    % if x_contiguous == 1:
+      dory_dma_memcpy_1d${'_blocking' if flag_DW == 1 else ''}(
+      l2_x + tile_load->x.ext, // extern
+      l1_buffer + tile_load->x.loc, // loc
+      tile_load->x.size, // size
+      1 // dir
+      );
+    % else:
+    % if flag_DW == 1 and hwc_to_chw_L1 == 1:
+      dory_dma_memcpy_3d_custom_blocking(
+    % elif flag_DW == 1:
       dory_dma_memcpy_3d_custom_hwc_to_chw(
     % else:
       dory_dma_memcpy_3d_custom(
     % endif
-      dory_get_tile_3d(l2_x, _i_h_load, _i_w_load, _i_nif_load, ${x_tile_size_h}, ${x_tile_size_w}, ${x_tile_size_nif}, ${x_w}, ${nif*g},  ${conv_overlap1}, ${conv_overlap2},0, pad_offset_h, pad_offset_w, 0, ${x_data_size_byte}), // extern
-      (l1_buffer + ${l1_x_offset}) + db_x, // loc
-      x_tile_size_byte, // size: dimension of the buffer
+      l2_x + tile_load->x.ext, // extern
+      l1_buffer + tile_load->x.loc, // loc
+      tile_load->x.size, // size: dimension of the buffer
       ${x_stride_w_byte}, // stride_1: stride for the 3d copy: if we have to copy on n_features axis, this is the stride to change from first 2D space to the next ones.
       ${x_stride_c_byte}, // stride_0: stride to be passed to 2d_copy: the dimension w of the in image
-      x_tile_size_h,// length_2: how many 2_d copies we need -> the dimension of the tile in n_features direction
-      x_length_nif_byte, // length_0: legnth of the 1_d copy, the length of tile in w direction
+      tile_load->x.length_2,// length_2: how many 2_d copies we need -> the dimension of the tile in n_features direction
+      tile_load->x.length_0, // length_0: legnth of the 1_d copy, the length of tile in w direction
       1, // dir
       &dma_evt // copy
       );
+    % endif
 % if dma_parallelization == '1-core':
       }
 % endif
     % endif
       // transfer of next weight tile if changed input or output channels
-      if (_i_nif_load!=_i_nif_exec || _i_nof_load!=_i_nof_exec)
+      if (tile_load->W.size)
       {
 % if dma_parallelization == '1-core':
         if (pi_core_id()==0)
         {
 % endif
-        % if flag_DW == 1:
-        dory_dma_memcpy_3d_custom_blocking(
-        % else:
-        dory_dma_memcpy_3d_custom_weights(
-        % endif
       % if flag_DW == 0:
-        dory_get_tile_3d(l2_W, _i_nof_load, 0, _i_nif_load, ${W_tile_size_nof}, ${fs1}*${fs2}, ${W_tile_size_nif}, ${fs1}*${fs2}, ${nif}, 0,0,0,0,0,0, ${W_data_size_byte}), // ext
-      % else:
-        dory_get_tile_3d(l2_W, _i_nof_load, 0, 0, ${W_tile_size_nof*8/W_data_size_byte}, ${fs1}*${fs2}, ${W_tile_size_nif}, ${fs1}*${fs2}, ${nif}, 0,0,0,0,0,0, ${W_data_size_byte}), // ext
-      % endif
-        (l1_buffer + ${l1_W_offset}) + db_W, // loc
-        W_tile_size_byte, // size: dimension of matrix of weight * bytes_per_weight
+        dory_dma_memcpy_3d_custom_weights(
+        l2_W + tile_load->W.ext, // ext
+        l1_buffer + tile_load->W.loc, // loc
+        tile_load->W.size, // size: dimension of matrix of weight * bytes_per_weight
         ${W_stride_nof_byte}, // stride_1: stride for the 3d copy: if we have to copy on n_features axis, this is the stride to change from first 2D space to the next ones.
         ${W_stride_hw_byte}, // stride_0: stride to be passed to 2d_copy: the dimension w of the in image
-        W_tile_size_nof, // length_2: how many 2_d copies we need -> the dimension of the tile in n_features direction
-        W_length_nif_byte, // length_0: legnth of the 1_d copy, the length of tile in w direction
+        tile_load->W.length_2, // length_2: how many 2_d copies we need -> the dimension of the tile in n_features direction
+        tile_load->W.length_0, // length_0: legnth of the 1_d copy, the length of tile in w direction
         1, // dir
         &dma_evt // copy
         );
+      % else:
+        // single transfer of the contiguous depthwise weight tile
+        dory_dma_memcpy_1d_blocking(
+        l2_W + tile_load->W.ext, // ext
+        l1_buffer + tile_load->W.loc, // loc
+        tile_load->W.size, // size
+        1 // dir
+        );
+      % endif
 % if dma_parallelization == '1-core':
         }
 % endif
-% if FLAG_BATCHNORM == 1:
+% if FLAG_BATCHNORM == 1 and BN_whole == 0 and n_buffers > 2:
+        // k and lambda travel with the transfer id of their tile
+        dory_dma_memcpy_3d_custom_weights(
+        l2_W+${l2_off_k} + tile_load->act.ext, // ext
+        (l1_buffer + ${l1_k_offset}) + tile_load->act.loc, // loc
+        tile_load->act.size, // size
+        0, 0, 1, 0, 1, &dma_evt);
+        dory_dma_memcpy_3d_custom_weights(
+        l2_W+${l2_off_lambda} + tile_load->act.ext, // ext
+        (l1_buffer + ${l1_lambda_offset}) + tile_load->act.loc, // loc
+        tile_load->act.size, // size
+        0, 0, 1, 0, 1, &dma_evt);
+% elif FLAG_BATCHNORM == 1 and BN_whole == 0:
         if(pi_core_id()==0)
         {
           copy_k.dir = PI_CL_DMA_DIR_EXT2LOC;
           copy_k.merge = 0;
-          copy_k.size = (uint16_t) W_tile_size_nof * ${int(act_dim_bit/8)};
+          copy_k.size = (uint16_t) tile_load->act.size;
           copy_k.id = 0;
-          copy_k.ext = (uint32_t) l2_W+${l2_off_k} + ${k_tile_size_byte_transfer}*_i_nof_load;
-          copy_k.loc = (uint32_t) l1_buffer + ${l1_k_offset} + db_act;
+          copy_k.ext = (uint32_t) l2_W+${l2_off_k} + tile_load->act.ext;
+          copy_k.loc = (uint32_t) l1_buffer + ${l1_k_offset} + tile_load->act.loc;
           pi_cl_dma_memcpy(&copy_k);   
           copy_lambda.dir = PI_CL_DMA_DIR_EXT2LOC;
           copy_lambda.merge = 0;
-          copy_lambda.size = (uint16_t) W_tile_size_nof * ${int(act_dim_bit/8)};
+          copy_lambda.size = (uint16_t) tile_load->act.size;
           copy_lambda.id = 0;
-          copy_lambda.ext = (uint32_t) l2_W+${l2_off_lambda} + ${lambda_tile_size_byte_transfer}*_i_nof_load;
-          copy_lambda.loc = (uint32_t) l1_buffer + ${l1_lambda_offset} + db_act;
+          copy_lambda.ext = (uint32_t) l2_W+${l2_off_lambda} + tile_load->act.ext;
+          copy_lambda.loc = (uint32_t) l1_buffer + ${l1_lambda_offset} + tile_load->act.loc;
           pi_cl_dma_memcpy(&copy_lambda);      
         }
 % endif
       }
     }
+% if n_buffers > 2:
+    if (iter < 0)
+    {
+      // ring warm-up: nothing to compute yet, the next tile gets its own transfer id
+      dma_evt_slot = dma_evt_slot == ${n_buffers-2} ? 0 : dma_evt_slot + 1;
+% if dma_parallelization == '1-core':
+      if (pi_core_id()==0)
+% endif
+      dma_evt_ring[dma_evt_slot] = mchan_alloc();
+      continue;
+    }
+% endif
     // creation of the pointers to input, output, weights, lambda and k
 % if flag_DW == 1:
     asm volatile("": : :"memory");
 % endif
-    x = (${type} *) (l1_buffer + ${l1_x_offset} + exec_db_x);
+    tile_exec = &${func_name}_tiles_dma[iter];
+    tile_args = &${func_name}_tiles_args[iter];
+    x = (${type} *) (l1_buffer + tile_exec->x.loc);
 % if FLAG_BATCHNORM == 1:
 % if act_dim_bit == 32:
-    k = (int32_t *) (l1_buffer + ${l1_k_offset} + exec_db_act);
-    lambda = (int32_t *) (l1_buffer + ${l1_lambda_offset} + exec_db_act);
+    k = (int32_t *) (l1_buffer + ${l1_k_offset} + tile_exec->act.loc);
+    lambda = (int32_t *) (l1_buffer + ${l1_lambda_offset} + tile_exec->act.loc);
 % else:
-    k = (int64_t *) (l1_buffer + ${l1_k_offset} + exec_db_act);
-    lambda = (int64_t *) (l1_buffer + ${l1_lambda_offset} + exec_db_act);
+    k = (int64_t *) (l1_buffer + ${l1_k_offset} + tile_exec->act.loc);
+    lambda = (int64_t *) (l1_buffer + ${l1_lambda_offset} + tile_exec->act.loc);
 % endif
 % endif
 % if has_bias == 1:
-    b = (${type} *) (l1_buffer + ${l1_b_offset} + _i_nof_exec*${bias_tile_size_byte});
+    b = (${type} *) (l1_buffer + ${l1_b_offset} + tile_args->b_loc);
 % endif
-    W = (${type} *) (l1_buffer + ${l1_W_offset} + exec_db_W);
-    y = (${type} *) (l1_buffer + ${l1_y_offset} + db_y);
+    W = (${type} *) (l1_buffer + tile_exec->W.loc);
+    y = (${type} *) (l1_buffer + tile_exec->y.loc);
     // parameter passed to the kernel. Input and output sizes
-    x_tile_size_nif_exec = (_i_nif_exec+1 == ${tile_dim_nif}) ? ${x_tile_size_nif_last} : ${x_tile_size_nif};
-    x_tile_size_h_exec   = (_i_h_exec+1 == ${tile_dim_h})   ? ${x_tile_size_h_last} : ${x_tile_size_h};
-    x_tile_size_w_exec   = (_i_w_exec+1 == ${tile_dim_w})   ? ${x_tile_size_w_last} : ${x_tile_size_w};
-    y_tile_size_nof = (_i_nof_exec+1 == ${tile_dim_nof}) ? ${y_tile_size_nof_last} : ${y_tile_size_nof};
-    y_tile_size_h   = (_i_h_exec+1 == ${tile_dim_h})   ? ${y_tile_size_h_last} : ${y_tile_size_h};
-    y_tile_size_w   = (_i_w_exec+1 == ${tile_dim_w})   ? ${y_tile_size_w_last} : ${y_tile_size_w};
-    y_tile_size_byte = y_tile_size_nof*y_tile_size_h*y_tile_size_w*${y_data_size_byte}/8;
-    y_length_nof_byte = (_i_nof_exec+1 == ${tile_dim_nof})   ? ${y_length_nof_byte_last} : ${y_tile_size_nof_byte};
-    p_r = 0;
-    p_l = 0;
-    p_t = 0;
-    p_b = 0;
-    if (_i_h_exec == 0)
-      p_t = ${padding_top};
-    if (_i_w_exec == 0)
-      p_l = ${padding_left};
-    if (_i_h_exec == ${tile_dim_h}-1)
-      p_b = ${padding_bottom};
-    if (_i_w_exec == ${tile_dim_w}-1)
-      p_r = ${padding_right};
+    x_tile_size_nif_exec = tile_args->x_tile_size_nif;
+    x_tile_size_h_exec   = tile_args->x_tile_size_h;
+    x_tile_size_w_exec   = tile_args->x_tile_size_w;
+    y_tile_size_nof = tile_args->y_tile_size_nof;
+    y_tile_size_h   = tile_args->y_tile_size_h;
+    y_tile_size_w   = tile_args->y_tile_size_w;
+    p_t = tile_args->p_t;
+    p_b = tile_args->p_b;
+    p_l = tile_args->p_l;
+    p_r = tile_args->p_r;
 
     pi_cl_team_barrier(0);
   % if tile_dim_nof*tile_dim_nif*tile_dim_h*tile_dim_w==1:
@@ -430,6 +394,12 @@ void ${func_name}(
   % if flag_DW==1:
     asm volatile("": : :"memory");
   % endif
+  % if hwc_to_chw_L1 == 1:
+    // the input tile is in HWC: all the cores transpose it to the CHW layout of the depthwise kernel
+    dory_hwc_to_chw((unsigned int) x, (unsigned int) (l1_buffer + ${l1_x_chw_offset}), x_tile_size_h_exec*x_tile_size_w_exec, x_tile_size_nif_exec);
+    x = (${type} *) (l1_buffer + ${l1_x_chw_offset});
+    pi_cl_team_barrier(0);
+  % endif
 % if flag_DW == 0:
   % if optional_type == '8bit' or optional_type == '1D_Conv':
     % if 'Relu0' in func_name:
@@ -586,11 +556,24 @@ void ${func_name}(
 % endif
     pi_cl_team_barrier(0);
 % if tile_dim_nif != 1 and flag_DW == 0:
-    if(_i_nif_load == 0) 
+    if(tile_exec->y.size) 
     {
 % endif
       // wait for DMA write/read
-% if chip == 'GAP8v3':
+% if n_buffers > 2:
+      // only the transfers of the next tile are waited; the write-back goes with a new transfer id
+      dma_evt_slot = dma_evt_slot == ${n_buffers-2} ? 0 : dma_evt_slot + 1;
+% if dma_parallelization == '1-core':
+      if (pi_core_id()==0)
+      {
+% endif
+      mchan_barrier(dma_evt_ring[dma_evt_slot]);
+      mchan_free(dma_evt_ring[dma_evt_slot]);
+      dma_evt_ring[dma_evt_slot] = mchan_alloc();
+% if dma_parallelization == '1-core':
+      }
+% endif
+% elif chip == 'GAP8v3':
 % if dma_parallelization == '1-core':
       if (pi_core_id()==0)
       {
@@ -601,7 +584,7 @@ void ${func_name}(
 % endif
 % endif   
 
-% if FLAG_BATCHNORM == 1:    
+% if FLAG_BATCHNORM == 1 and BN_whole == 0 and n_buffers == 2:    
 % if flag_DW == 0:
     if(iter<${tile_dim_nof}*${tile_dim_nif}*${tile_dim_h}*${tile_dim_w}-1) 
     {
@@ -609,7 +592,7 @@ void ${func_name}(
     if(iter<${tile_dim_nof}*${tile_dim_h}*${tile_dim_w}-1) 
     {  
 % endif 
-      if(pi_core_id()==0 && (_i_nif_load!=_i_nif_exec || _i_nof_load!=_i_nof_exec))
+      if(pi_core_id()==0 && ${func_name}_tiles_dma[iter+1].W.size)
       {                                       
         pi_cl_dma_wait(&copy_k);                                                    
         pi_cl_dma_wait(&copy_lambda);
@@ -620,33 +603,37 @@ void ${func_name}(
         if (pi_core_id()==0)
         {
 % endif                        
+% if y_contiguous == 1:
+        // the output tile is contiguous in L2: a single transfer
+        dory_dma_memcpy_1d${'_blocking' if flag_DW == 1 else ''}(
+        l2_y + tile_exec->y.ext, // ext
+        l1_buffer + tile_exec->y.loc, // loc
+        tile_exec->y.size, // size
+        0 // dir
+        );
+% else:
 % if flag_DW == 1:
         dory_dma_memcpy_3d_custom_blocking(
 % else:
         dory_dma_memcpy_3d_custom_out(
 % endif
-        dory_get_tile_3d(l2_y, _i_h_exec, _i_w_exec, _i_nof_exec, ${y_tile_size_h}, ${y_tile_size_w}, ${y_tile_size_nof}, ${y_w}, ${int(nof*factor)}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}), // ext
-        (l1_buffer + ${l1_y_offset}) + db_y, // loc
-        y_tile_size_byte, // size
+        l2_y + tile_exec->y.ext, // ext
+        l1_buffer + tile_exec->y.loc, // loc
+        tile_exec->y.size, // size
         ${y_stride_w_byte}, // stride_1
         ${y_stride_c_byte}, // stride_0
-        y_tile_size_h, // length_2
-        y_length_nof_byte, // length_0
+        tile_exec->y.length_2, // length_2
+        tile_exec->y.length_0, // length_0
         0, // dir
         &dma_evt // copy
         );
+% endif
 % if dma_parallelization == '1-core':
         }
 % endif
 % if tile_dim_nif != 1 and flag_DW == 0:
     }
 % endif
-    // update prev iterators
-    db_state_y = ! db_state_y; 
-    _i_nof_exec = _i_nof_load;
-    _i_nif_exec = _i_nif_load;
-    _i_h_exec = _i_h_load;
-    _i_w_exec = _i_w_load;
     pi_cl_team_barrier(0);
   }
 
@@ -657,8 +644,16 @@ void ${func_name}(
   if (pi_core_id()==0)
   {
 % endif
+  % if n_buffers > 2:
+  for(int i=0; i<${n_buffers-1}; i++)
+  {
+    mchan_barrier(dma_evt_ring[i]);
+    mchan_free(dma_evt_ring[i]);
+  }
+  % else:
   mchan_barrier(dma_evt);
   mchan_free(dma_evt);
+  % endif
 % if dma_parallelization == '1-core':
   }
 % endif
@@ -53,24 +53,16 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
   char* L2_weights_2;
   int d_buffering_weights_t = 0;
   int d_buffering_weights_e = 0;
-  pi_cl_ram_req_t buff_req_w1, buff_req_w2, buff_req_w3;
+  pi_cl_ram_req_t buff_req_w1;
   L2_weights_1 = l2_W;
-  L2_weights_2 = l2_W + ${weight_dim} + ${lambda_dim} + ${k_dim};
+  L2_weights_2 = l2_W + ${weight_tile_dim};
   transfer_weights = L2_weights_1;
   exec_weights = L2_weights_1;  
-  // first tile transfer. Weights, k, lambda
+  // first tile transfer. Weights, bias, k and lambda of each tile are contiguous in L3 (Model_deployment.tile_major_weights)
   if(pi_core_id()==0)
   {
-    pi_cl_ram_read(hyperram, l3_W, transfer_weights, ${weight_dim}, &buff_req_w1);
-    % if k_dim != 0:
-    pi_cl_ram_read(hyperram, l3_W+${weight_dim*n_tile_W}, transfer_weights + ${weight_dim}, ${k_dim}, &buff_req_w2);
-    pi_cl_ram_read(hyperram, l3_W+${(weight_dim+k_dim)*n_tile_W}, transfer_weights + ${weight_dim} + ${k_dim}, ${lambda_dim}, &buff_req_w3);
-    % endif 
+    pi_cl_ram_read(hyperram, l3_W, transfer_weights, ${weight_tile_dim}, &buff_req_w1);
     pi_cl_ram_read_wait(&buff_req_w1);
-    % if k_dim != 0:
-    pi_cl_ram_read_wait(&buff_req_w2);
-    pi_cl_ram_read_wait(&buff_req_w3);
-    % endif
   }
   // switching buffers
   d_buffering_weights_t = !d_buffering_weights_t;
@@ -97,7 +89,7 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
   transfer_input = input_t ? L2_input_2 : L2_input_1;
   % endif
   % if n_tile_y > 1:
-  // output L3 tiling. Parameters
+  // output L3 tiling. Parameters. Each L2 output tile contains all the ${n_out * n_tile_W} output channels
   % if verbose == 1:
   int checksum = 0;
   % endif
@@ -107,201 +99,138 @@ void __attribute__ ((noinline)) ${func_name_L3}(void *args)
   int output_e = 0;
   pi_cl_ram_req_t buff_req_y1;
   L2_output_1 = l2_y;
-  L2_output_2 = l2_y + ${dim_out};
+  L2_output_2 = l2_y + ${dim_out * n_tile_W};
   transfer_output = output_t ? L2_output_2 : L2_output_1;
   exec_output = output_e ? L2_output_2 : L2_output_1;
   % endif
-  % if n_tile_y > 1 and n_tile_x > 1:
-  // loop over input/output tiles
-  for(int j=0; j<${n_tile_x}; j++) 
-  {
-    if(pi_core_id()==0)
-    {
-      int shift = 0; 
-      if (j==0)
-        shift = ${dim_in-conv_overlap1*n_in*w_in - padding*n_in*w_in};
-      else
-        shift = ${dim_in-conv_overlap1*n_in*w_in - padding*n_in*w_in} + j*${dim_in-conv_overlap1*n_in*w_in};
-      // read from L3 of the new input tile. The shift is computed based on the overlap
-      if (j<${n_tile_x-1})
-        pi_cl_ram_read(hyperram, l3_x + shift, transfer_input, ${dim_in}, &buff_req_x1);
-    }    
-    input_t = !input_t;
-    transfer_input = input_t ? L2_input_2 : L2_input_1;
-  % elif n_tile_y > 1:
-  // loop over output tiles
-  for(int j=0; j<${n_tile_y}; j++) 
-  {
-  % elif n_tile_x > 1:
-  // loop over input tiles
-  for(int j=0; j<${n_tile_x}; j++) 
+<%
+  n_tile_act = n_tile_x if n_tile_x > 1 else n_tile_y
+  n_iter = n_tile_act * n_tile_W
+%>
+  // loop over ${n_tile_act} activation tiles and ${n_tile_W} weight tiles, ${loop_order} in the outer loop
+  int j, k, j_next, k_next;
+  for(int iter=0; iter<${n_iter}; iter++)
   {
-    if(pi_core_id()==0)
-    {
-      pi_cl_ram_read_wait(&buff_req_x1);
-      int shift = 0; 
-      if (j==0)
-        shift = ${dim_in-conv_overlap1*n_in*w_in - padding*n_in*w_in};
-      else
-        shift = ${dim_in-conv_overlap1*n_in*w_in - padding*n_in*w_in} + j*${dim_in-conv_overlap1*n_in*w_in};
-      // read from L3 of the new input tile. The shift is computed based on the overlap
-      if (j<${n_tile_x-1})
-        pi_cl_ram_read(hyperram, l3_x + shift, transfer_input, ${dim_in}, &buff_req_x1);
-    }    
-    input_t = !input_t;
-    transfer_input = input_t ? L2_input_2 : L2_input_1;
+  % if loop_order == 'weights':
+    k = iter / ${n_tile_act};
+    j = iter % ${n_tile_act};
+    k_next = (iter + 1) / ${n_tile_act};
+    j_next = (iter + 1) % ${n_tile_act};
   % else:
-  int j = 0;
+    j = iter / ${n_tile_W};
+    k = iter % ${n_tile_W};
+    j_next = (iter + 1) / ${n_tile_W};
+    k_next = (iter + 1) % ${n_tile_W};
   % endif
-  % if n_tile_W > 1:
-  // loop over weight tiles
-  for(int k=0; k<${n_tile_W}; k++) 
-  {
-    if (k < ${n_tile_W-1}) 
+    // prefetch from L3 of the tiles used by the next iteration, if they change
+    if(pi_core_id()==0 && iter < ${n_iter - 1})
     {
-      if(pi_core_id()==0) 
+    % if n_tile_W > 1:
+      if (k_next != k)
       {
-        pi_cl_ram_read(hyperram, (l3_W+(k+1)*${weight_dim}), transfer_weights, ${weight_dim}, &buff_req_w1);
-        % if k_dim != 0:
-        pi_cl_ram_read(hyperram, l3_W+${weight_dim*n_tile_W}+ (k+1)*${k_dim}, transfer_weights + ${weight_dim}, ${k_dim}, &buff_req_w2);
-        pi_cl_ram_read(hyperram, l3_W+${(weight_dim+k_dim)*n_tile_W} + (k+1)*${lambda_dim}, transfer_weights + ${weight_dim}+ ${k_dim}, ${lambda_dim}, &buff_req_w3);
-        % endif
+        pi_cl_ram_read(hyperram, l3_W + k_next*${weight_tile_dim}, transfer_weights, ${weight_tile_dim}, &buff_req_w1);
       }
-    }  
-  % else:
-    int k = 0;
-  % endif
+    % endif
+    % if n_tile_x > 1:
+      if (j_next != j)
+      {
+        // read from L3 of the new input tile. The shift is computed based on the overlap
+        int shift = 0;
+        if (j_next > 0)
+          shift = ${dim_in-conv_overlap1*n_in*w_in - padding*n_in*w_in} + (j_next-1)*${dim_in-conv_overlap1*n_in*w_in};
+        pi_cl_ram_read(hyperram, l3_x + shift, transfer_input, ${dim_in}, &buff_req_x1);
+      }
+    % endif
+    }
     // execution of L2-L1 layer. Either top, middle or bottom layer.
     pi_cl_team_barrier(0);
+    unsigned int args[13] = {l3_x,
+        l3_y,
+        l3_W,
+        % if n_tile_x > 1:
+        exec_input,
+        % else:
+        j == 0 ? (unsigned int) exec_input : dory_get_tile_3d(exec_input, j, 0, 0, ${h_in}, ${w_in}, ${n_in}, ${w_in}, ${n_in}, ${conv_overlap1}, ${conv_overlap2},0, ${padding}, 0, 0, ${x_data_size_byte}),
+        % endif
+        l2_x_2,
+        % if n_tile_y > 1:
+        dory_get_tile_3d(exec_output, 0, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
+        % else:
+        dory_get_tile_3d(exec_output, j, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
+        % endif
+        exec_weights,
+        l1_buffer,
+        hyperram,
+        outmult,
+        mult1,
+        mult2,
+        out_shift};
+    % if n_tile_act > 1 and padding > 0:
     if (j==0)
-    {
-      unsigned int args[13] = {l3_x,
-          l3_y,
-          l3_W,
-          exec_input,
-          l2_x_2,
-          dory_get_tile_3d(exec_output, 0, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
-          exec_weights,
-          l1_buffer,
-          hyperram,
-          outmult,
-          mult1,
-          mult2,
-          out_shift};
-      % if (n_tile_x > 1 or n_tile_y > 1) and padding > 0:
-      ${func_name[1]}(\
-      % else:
-      ${func_name[0]}(\
-      % endif
-          args);
-    }
-    % if n_tile_x > 1:
-    else if (j==(${n_tile_x-1}))
-    {
+      ${func_name[1]}(args);
+    else if (j==${n_tile_act-1})
+      ${func_name[2]}(args);
+    else
+      ${func_name[0]}(args);
     % else:
-    else if (j==(${n_tile_y-1}))
+    ${func_name[0]}(args);
+    % endif
+    pi_cl_team_barrier(0);
+    if(pi_core_id()==0 && iter < ${n_iter - 1})
     {
+    % if n_tile_W > 1:
+      // waiting for weights, bias, k and lambda
+      if (k_next != k)
+        pi_cl_ram_read_wait(&buff_req_w1);
+    % endif
+    % if n_tile_x > 1:
+      // waits for input transfer to be ended
+      if (j_next != j)
+        pi_cl_ram_read_wait(&buff_req_x1);
     % endif
-      unsigned int args[13] = {l3_x,
-          l3_y,
-          l3_W,
-          % if n_tile_x > 1 or n_tile_W > 1:
-          exec_input,
-          % else:
-          dory_get_tile_3d(exec_input, j, 0, 0, ${h_in}, ${w_in}, ${n_in}, ${w_in}, ${n_in}, ${conv_overlap1}, ${conv_overlap2},0, ${padding}, 0, 0, ${x_data_size_byte}),
-          % endif
-          l2_x_2,
-          % if n_tile_y > 1:
-          dory_get_tile_3d(exec_output, 0, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
-          % else:
-          dory_get_tile_3d(exec_output, j, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
-          % endif
-          exec_weights,
-          l1_buffer,
-          hyperram,
-          outmult,
-          mult1,
-          mult2,
-          out_shift};
-      % if (n_tile_x > 1 or n_tile_y > 1) and padding > 0:
-      ${func_name[2]}(\
-      % else:
-      ${func_name[0]}(\
-      % endif
-          args);
     }
-    else
+  % if n_tile_W > 1:
+    if (k_next != k)
     {
-      unsigned int args[13] = {l3_x,
-          l3_y,
-          l3_W,
-          % if n_tile_x > 1 or n_tile_W > 1:
-          exec_input,
-          % else:
-          dory_get_tile_3d(exec_input, j, 0, 0, ${h_in}, ${w_in}, ${n_in}, ${w_in}, ${n_in}, ${conv_overlap1}, ${conv_overlap2},0, ${padding}, 0, 0, ${x_data_size_byte}),
-          % endif
-          l2_x_2,
-          % if n_tile_y > 1:
-          dory_get_tile_3d(exec_output, 0, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
-          % else:
-          dory_get_tile_3d(exec_output, j, 0, k, ${h_out}, ${w_out}, ${n_out}, ${w_out}, ${n_out * n_tile_W}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}),
-          % endif
-          exec_weights,
-          l1_buffer,
-          hyperram,
-          outmult,
-          mult1,
-          mult2,
-          out_shift};
-      ${func_name[0]}(args);   
-      }    
-      pi_cl_team_barrier(0);
-      % if n_tile_W > 1:
-        if(pi_core_id()==0)
-        {
-          // waiting for weights, lambda, and k
-          pi_cl_ram_read_wait(&buff_req_w1);
-          % if k_dim != 0:
-          pi_cl_ram_read_wait(&buff_req_w2);
-          pi_cl_ram_read_wait(&buff_req_w3);
-          % endif
-        }
-        d_buffering_weights_e = !d_buffering_weights_e;
-        exec_weights = d_buffering_weights_e ? L2_weights_2 : L2_weights_1;
-        d_buffering_weights_t = !d_buffering_weights_t;
-        transfer_weights = d_buffering_weights_t ? L2_weights_2 : L2_weights_1;
-      }   
-      % endif 
+      d_buffering_weights_e = !d_buffering_weights_e;
+      exec_weights = d_buffering_weights_e ? L2_weights_2 : L2_weights_1;
+      d_buffering_weights_t = !d_buffering_weights_t;
+      transfer_weights = d_buffering_weights_t ? L2_weights_2 : L2_weights_1;
+    }
+  % endif
   % if n_tile_x > 1:
-    input_e = !input_e;
-    exec_input = input_e ? L2_input_2 : L2_input_1;
+    if (j_next != j)
+    {
+      input_e = !input_e;
+      exec_input = input_e ? L2_input_2 : L2_input_1;
+      input_t = !input_t;
+      transfer_input = input_t ? L2_input_2 : L2_input_1;
+    }
   % endif
   % if n_tile_y > 1:
-    if(pi_core_id()==0) 
+    // the output tile is complete once all the weight tiles have been applied
+    if (j_next != j || iter == ${n_iter - 1})
     {
-      % if n_tile_x > 1:
-      // waits for input transfer to be ended
-      pi_cl_ram_read_wait(&buff_req_x1);
+      if(pi_core_id()==0)
+      {
+        // waits for output transfer to be ended
+        if (j > 0)
+          pi_cl_ram_write_wait(&buff_req_y1);
+        pi_cl_ram_write(hyperram, (l3_y + j*${dim_out * n_tile_W}), transfer_output, ${dim_out * n_tile_W}, &buff_req_y1);
+      % if verbose == 1:
+        for(int i=0; i<${dim_out * n_tile_W}; i++)
+          checksum += transfer_output[i];
+        printf("checksum = %d\n", checksum);
       % endif
-      // waits for output transfer to be ended
-      if (j > 0)
-        pi_cl_ram_write_wait(&buff_req_y1);
-      pi_cl_ram_write(hyperram, (l3_y + j*${dim_out}), transfer_output, ${dim_out}, &buff_req_y1);
-    % if verbose == 1:
-    for(int j=0; j<${dim_out}; j++) 
-      checksum += transfer_output[j];
-    printf("checksum = %d\n", checksum);
-    % endif
+      }
+      // switching parameters
+      output_e = !output_e;
+      output_t = !output_t;
+      exec_output = output_e ? L2_output_2 : L2_output_1;
+      transfer_output = output_t ? L2_output_2 : L2_output_1;
     }
-    // switching parameters
-    output_e = !output_e;
-    output_t = !output_t;
-    exec_output = output_e ? L2_output_2 : L2_output_1;
-    transfer_output = output_t ? L2_output_2 : L2_output_1;
   % endif
-  % if n_tile_x > 1 or n_tile_y > 1:
   }
-  % endif
   % if n_tile_y > 1:
   // last wait
   if(pi_core_id()==0) 
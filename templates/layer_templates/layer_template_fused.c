@@ -0,0 +1,413 @@
+/*
+ * layer_template_fused.c
+ * Alessio Burrello <alessio.burrello@unibo.it>
+ *
+ * Copyright (C) 2019-2020 University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "${func_name}.h"
+#include "mem_controller.h"
+% if ULTRA_VERBOSE:
+#define VERBOSE_PRINT(...) printf(__VA_ARGS__)
+% endif
+
+// Depthwise ${fs1}x${fs2} + pointwise layer executed depth-first.
+// Tiles span all the channels and the whole width: for each tile of ${y_tile_size_h} output rows
+// the depthwise output stays in L1 and is the input of the pointwise kernel.
+// Only the output of the pointwise is written back to L2.
+void ${func_name}(
+  void *args
+) {
+  //////////////////////////////////////////////////////////////////////////
+  // arguments assigning: keeping same interface between L2 and L3 memory //
+  //////////////////////////////////////////////////////////////////////////
+  unsigned int *real_arg = (unsigned int *) args;
+  unsigned int l3_x =(unsigned int)  real_arg[0];
+  unsigned int l3_y =(unsigned int)  real_arg[1];
+  unsigned int l3_W =(unsigned int)  real_arg[2];
+  unsigned int l2_x =(unsigned int)  real_arg[3];
+  unsigned int l2_x_2 =(unsigned int)  real_arg[4];
+  unsigned int l2_y =(unsigned int)  real_arg[5];
+  unsigned int l2_W =(unsigned int)  real_arg[6];
+  unsigned int l1_buffer =(unsigned int)  real_arg[7];
+  unsigned int hyperram =(unsigned int)  real_arg[8];
+  unsigned int out_mult_in =(unsigned int)  real_arg[9];
+  unsigned int inmul1 = (unsigned int) real_arg[10];
+  unsigned int inmul2 = (unsigned int) real_arg[11];
+  unsigned int out_shift_in = (unsigned int) real_arg[12];
+
+  //////////////////////////
+  // Variable declaration //
+  //////////////////////////
+  unsigned int dma_evt;
+  volatile int p_r, p_l, p_t, p_b;
+% if tile_dim_h != 1:
+  volatile unsigned short  x_tile_size_h;
+  volatile unsigned short  x_tile_size_byte;
+  volatile int pad_offset_h;
+% endif
+  volatile ${type} *x;
+  volatile ${type} *x_dw;
+  volatile ${type} *y;
+  volatile ${type} *W_dw;
+  volatile ${type} *W_pw;
+% if FLAG_BATCHNORM == 1:
+% if act_dim_bit == 32:
+  volatile int32_t *k_dw;
+  volatile int32_t *lambda_dw;
+  volatile int32_t *k_pw;
+  volatile int32_t *lambda_pw;
+% else:
+  volatile int64_t *k_dw;
+  volatile int64_t *lambda_dw;
+  volatile int64_t *k_pw;
+  volatile int64_t *lambda_pw;
+% endif
+% endif
+  volatile int x_tile_size_h_exec;
+  volatile int y_tile_size_h;
+  volatile int y_tile_size_byte;
+  volatile int db_x;
+  volatile int db_y;
+  volatile int exec_db_x;
+  // double buffering state
+  int db_state_x=0;
+  int db_state_y=1;
+  int iter;
+  // tile loop indeces
+  int _i_h_load=0, _i_h_exec=0;
+  volatile ${type} *im2col;
+  im2col = l1_buffer + ${buffer_l1_all};
+  volatile ${type} *pwt_buffer;
+  pwt_buffer = im2col + ${im2col_dim};
+#ifdef MEMORY_STATISTICS
+  if (pi_core_id()==0)
+    dory_L1_used(${buffer_l1_all + im2col_dim});
+#endif
+% if FLAG_RELU == 1:
+  uint16_t out_mult = out_mult_in;
+  uint16_t out_shift = out_shift_in;
+% endif
+  ///////////////////////////////////////////////////////////////////
+  /// Not Double buffered transfers: weights, k and lambda of both ///
+  ///////////////////////////////////////////////////////////////////
+  if(pi_core_id()==0)
+  {
+    pi_cl_dma_copy_t copy_W_dw, copy_W_pw;
+    copy_W_dw.dir = PI_CL_DMA_DIR_EXT2LOC;
+    copy_W_dw.merge = 0;
+    copy_W_dw.size = (uint16_t) ${W_dw_size_byte};
+    copy_W_dw.id = 0;
+    copy_W_dw.ext = (uint32_t) l2_W+${l2_off_W_dw};
+    copy_W_dw.loc = (uint32_t) l1_buffer + ${l1_W_dw_offset};
+    pi_cl_dma_memcpy(&copy_W_dw);
+    copy_W_pw.dir = PI_CL_DMA_DIR_EXT2LOC;
+    copy_W_pw.merge = 0;
+    copy_W_pw.size = (uint16_t) ${W_pw_size_byte};
+    copy_W_pw.id = 0;
+    copy_W_pw.ext = (uint32_t) l2_W+${l2_off_W_pw};
+    copy_W_pw.loc = (uint32_t) l1_buffer + ${l1_W_pw_offset};
+    pi_cl_dma_memcpy(&copy_W_pw);
+% if FLAG_BATCHNORM == 1:
+    pi_cl_dma_copy_t copy_k_dw, copy_lambda_dw, copy_k_pw, copy_lambda_pw;
+    copy_k_dw.dir = PI_CL_DMA_DIR_EXT2LOC;
+    copy_k_dw.merge = 0;
+    copy_k_dw.size = (uint16_t) ${k_dw_size_byte};
+    copy_k_dw.id = 0;
+    copy_k_dw.ext = (uint32_t) l2_W+${l2_off_k_dw};
+    copy_k_dw.loc = (uint32_t) l1_buffer + ${l1_k_dw_offset};
+    pi_cl_dma_memcpy(&copy_k_dw);
+    copy_lambda_dw.dir = PI_CL_DMA_DIR_EXT2LOC;
+    copy_lambda_dw.merge = 0;
+    copy_lambda_dw.size = (uint16_t) ${k_dw_size_byte};
+    copy_lambda_dw.id = 0;
+    copy_lambda_dw.ext = (uint32_t) l2_W+${l2_off_lambda_dw};
+    copy_lambda_dw.loc = (uint32_t) l1_buffer + ${l1_lambda_dw_offset};
+    pi_cl_dma_memcpy(&copy_lambda_dw);
+    copy_k_pw.dir = PI_CL_DMA_DIR_EXT2LOC;
+    copy_k_pw.merge = 0;
+    copy_k_pw.size = (uint16_t) ${k_pw_size_byte};
+    copy_k_pw.id = 0;
+    copy_k_pw.ext = (uint32_t) l2_W+${l2_off_k_pw};
+    copy_k_pw.loc = (uint32_t) l1_buffer + ${l1_k_pw_offset};
+    pi_cl_dma_memcpy(&copy_k_pw);
+    copy_lambda_pw.dir = PI_CL_DMA_DIR_EXT2LOC;
+    copy_lambda_pw.merge = 0;
+    copy_lambda_pw.size = (uint16_t) ${k_pw_size_byte};
+    copy_lambda_pw.id = 0;
+    copy_lambda_pw.ext = (uint32_t) l2_W+${l2_off_lambda_pw};
+    copy_lambda_pw.loc = (uint32_t) l1_buffer + ${l1_lambda_pw_offset};
+    pi_cl_dma_memcpy(&copy_lambda_pw);
+    pi_cl_dma_wait(&copy_k_dw);
+    pi_cl_dma_wait(&copy_lambda_dw);
+    pi_cl_dma_wait(&copy_k_pw);
+    pi_cl_dma_wait(&copy_lambda_pw);
+% endif
+    pi_cl_dma_wait(&copy_W_dw);
+    pi_cl_dma_wait(&copy_W_pw);
+  }
+  pi_cl_team_barrier(0);
+% if chip == 'GAP8v3':
+  //////////////////////////////////////////////////////////////
+  // Allocation of one channel per each core for DMA transfer //
+  //////////////////////////////////////////////////////////////
+% if dma_parallelization == '8-cores':
+  dma_evt = mchan_alloc();
+% elif dma_parallelization == '1-core':
+  if (pi_core_id()==0)
+    dma_evt = mchan_alloc();
+% endif
+% endif
+  ////////////////////////////
+  // First tile transfering //
+  ////////////////////////////
+% if dma_parallelization == '1-core':
+  if (pi_core_id()==0)
+  {
+% endif
+  dory_dma_memcpy_3d_custom_hwc_to_chw(
+  l2_x, // ext
+  (l1_buffer + ${l1_x_offset}) + 0, // loc
+  ${x_tile_size_byte}, // size: dimension of the buffer
+  ${x_stride_w_byte}, // stride_1: stride for the 3d copy: if we have to copy on n_features axis, this is the stride to change from first 2D space to the next ones.
+  ${x_stride_c_byte}, // stride_0: stride to be passed to 2d_copy: the dimension w of the in image
+  ${x_tile_size_h},// length_2: how many 2_d copies we need -> the dimension of the tile in n_features direction
+  ${nif}, // length_0: legnth of the 1_d copy, the length of tile in w direction
+  1, // dir
+  &dma_evt // copy
+  );
+  % if chip == 'GAP8v3':
+  mchan_barrier(dma_evt);
+  % endif
+% if dma_parallelization == '1-core':
+  }
+% endif
+  pi_cl_team_barrier(0);
+  W_dw = (${type} *) (l1_buffer + ${l1_W_dw_offset});
+  W_pw = (${type} *) (l1_buffer + ${l1_W_pw_offset});
+% if FLAG_BATCHNORM == 1:
+% if act_dim_bit == 32:
+  k_dw = (int32_t *) (l1_buffer + ${l1_k_dw_offset});
+  lambda_dw = (int32_t *) (l1_buffer + ${l1_lambda_dw_offset});
+  k_pw = (int32_t *) (l1_buffer + ${l1_k_pw_offset});
+  lambda_pw = (int32_t *) (l1_buffer + ${l1_lambda_pw_offset});
+% else:
+  k_dw = (int64_t *) (l1_buffer + ${l1_k_dw_offset});
+  lambda_dw = (int64_t *) (l1_buffer + ${l1_lambda_dw_offset});
+  k_pw = (int64_t *) (l1_buffer + ${l1_k_pw_offset});
+  lambda_pw = (int64_t *) (l1_buffer + ${l1_lambda_pw_offset});
+% endif
+% endif
+  x_dw = (${type} *) (l1_buffer + ${l1_x_dw_offset});
+
+  // tile loop nest: h only
+  for(iter=0; iter<${tile_dim_h}; iter++) {
+    _i_h_load += 1;
+    // compute double buffering offsets and update db state
+    db_y = !db_state_y ? ${y_tile_size_byte} : 0;
+  % if tile_dim_h != 1:
+    db_x = !db_state_x ? ${x_tile_size_byte} : 0;
+    exec_db_x = db_state_x ? ${x_tile_size_byte} : 0;
+  % else:
+    exec_db_x = 0;
+  % endif
+    db_state_x = ! db_state_x;
+  % if tile_dim_h != 1:
+    // double buffered read of the next input tile, overlapping with the current one by the depthwise halo
+    if(iter<${tile_dim_h}-1)
+    {
+      asm volatile("": : :"memory");
+      x_tile_size_h   = (_i_h_load+1 == ${tile_dim_h})   ? ${x_tile_size_h_last} : ${x_tile_size_h};
+      x_tile_size_byte = x_tile_size_h*${x_w}*${nif};
+      pad_offset_h=0;
+      if(_i_h_load > 0)
+        pad_offset_h = ${padding_top};
+% if dma_parallelization == '1-core':
+      if (pi_core_id()==0)
+      {
+% endif
+      dory_dma_memcpy_3d_custom_hwc_to_chw(
+      dory_get_tile_3d(l2_x, _i_h_load, 0, 0, ${x_tile_size_h}, ${x_w}, ${nif}, ${x_w}, ${nif},  ${conv_overlap1}, 0, 0, pad_offset_h, 0, 0, ${x_data_size_byte}), // extern
+      (l1_buffer + ${l1_x_offset}) + db_x, // loc
+      x_tile_size_byte, // size: dimension of the buffer
+      ${x_stride_w_byte}, // stride_1: stride for the 3d copy: if we have to copy on n_features axis, this is the stride to change from first 2D space to the next ones.
+      ${x_stride_c_byte}, // stride_0: stride to be passed to 2d_copy: the dimension w of the in image
+      x_tile_size_h,// length_2: how many 2_d copies we need -> the dimension of the tile in n_features direction
+      ${nif}, // length_0: legnth of the 1_d copy, the length of tile in w direction
+      1, // dir
+      &dma_evt // copy
+      );
+% if dma_parallelization == '1-core':
+      }
+% endif
+    }
+  % endif
+    asm volatile("": : :"memory");
+    x = (${type} *) (l1_buffer + ${l1_x_offset} + exec_db_x);
+    y = (${type} *) (l1_buffer + ${l1_y_offset} + db_y);
+    // parameter passed to the kernels. Input and output sizes
+    x_tile_size_h_exec = (_i_h_exec+1 == ${tile_dim_h}) ? ${x_tile_size_h_last} : ${x_tile_size_h};
+    y_tile_size_h   = (_i_h_exec+1 == ${tile_dim_h})   ? ${y_tile_size_h_last} : ${y_tile_size_h};
+    y_tile_size_byte = ${nof}*y_tile_size_h*${y_w}*${y_data_size_byte}/8;
+    p_r = ${padding_right};
+    p_l = ${padding_left};
+    p_t = 0;
+    p_b = 0;
+    if (_i_h_exec == 0)
+      p_t = ${padding_top};
+    if (_i_h_exec == ${tile_dim_h}-1)
+      p_b = ${padding_bottom};
+
+    pi_cl_team_barrier(0);
+    asm volatile("": : :"memory");
+    // depthwise: output in HWC format in the L1 intermediate buffer
+  % if fs1 == 3 and fs2 == 3 and stride==1:
+    pulp_nn_depthwise_generic(
+  % elif fs1*fs2 < 4:
+    pulp_nn_depthwise_generic_less_4_weights(
+  % else:
+    pulp_nn_depthwise_generic(
+  % endif
+    x,
+    ${x_w},
+    x_tile_size_h_exec,
+    ${nif},
+    W_dw,
+    ${nif},
+    ${fs2},
+    ${fs1},
+    p_t,
+    p_b,
+    p_l,
+    p_r,
+    ${stride},
+    ${stride},
+    NULL,
+    0,
+  % if FLAG_RELU == 1:
+    out_shift,
+    out_mult,
+  % else:
+    0,
+    0,
+  % endif
+    x_dw,
+    ${y_w},
+    y_tile_size_h,
+  % if FLAG_BATCHNORM == 1:
+    k_dw,
+    lambda_dw,
+  % else:
+    0,
+    0,
+  % endif
+    im2col,
+    pwt_buffer,
+    ${FLAG_RELU},
+    ${FLAG_BATCHNORM},
+    &dma_evt
+    );
+    pi_cl_team_barrier(0);
+    // pointwise on the depthwise output of the same tile
+    pulp_nn_pointwise_HoWo_parallel(
+    x_dw,
+    ${y_w},
+    y_tile_size_h,
+    ${nif},
+    W_pw,
+    ${nof},
+    1,
+    1,
+    0,
+    0,
+    0,
+    0,
+    1,
+    1,
+    NULL,
+    0,
+  % if FLAG_RELU == 1:
+    ${pw_out_shift},
+    ${pw_out_mult},
+  % else:
+    0,
+    0,
+  % endif
+    y,
+    ${y_w},
+    y_tile_size_h,
+  % if FLAG_BATCHNORM == 1:
+    k_pw,
+    lambda_pw,
+  % else:
+    0,
+    0,
+  % endif
+    im2col,
+    ${FLAG_RELU},
+    ${FLAG_BATCHNORM},
+    &dma_evt
+    );
+    pi_cl_team_barrier(0);
+      // wait for DMA write/read
+% if chip == 'GAP8v3':
+% if dma_parallelization == '1-core':
+      if (pi_core_id()==0)
+      {
+% endif
+      mchan_barrier(dma_evt);
+% if dma_parallelization == '1-core':
+      }
+% endif
+% endif
+% if dma_parallelization == '1-core':
+        if (pi_core_id()==0)
+        {
+% endif
+        dory_dma_memcpy_3d_custom_out(
+        dory_get_tile_3d(l2_y, _i_h_exec, 0, 0, ${y_tile_size_h}, ${y_w}, ${nof}, ${y_w}, ${nof}, 0, 0, 0, 0, 0, 0, ${y_data_size_byte}), // ext
+        (l1_buffer + ${l1_y_offset}) + db_y, // loc
+        y_tile_size_byte, // size
+        ${y_stride_w_byte}, // stride_1
+        ${y_stride_c_byte}, // stride_0
+        y_tile_size_h, // length_2
+        ${y_stride_c_byte}, // length_0
+        0, // dir
+        &dma_evt // copy
+        );
+% if dma_parallelization == '1-core':
+        }
+% endif
+    // update prev iterators
+    db_state_y = ! db_state_y;
+    _i_h_exec = _i_h_load;
+    pi_cl_team_barrier(0);
+  }
+
+% if not TEST:
+  // wait for final write
+  % if chip == 'GAP8v3':
+% if dma_parallelization == '1-core':
+  if (pi_core_id()==0)
+  {
+% endif
+  mchan_barrier(dma_evt);
+  mchan_free(dma_evt);
+% if dma_parallelization == '1-core':
+  }
+% endif
+  % endif
+% endif
+}
@@ -17,8 +17,16 @@
  * limitations under the License. 
  */
 
+#include "pmsis.h"
 #include "mem_controller.h"
 //#define VERBOSE
+// beginning of the L2 memory, subtracted from the pointers printed in VERBOSE mode
+#define L2_BASE 0x1C000000
+
+#ifdef MEMORY_STATISTICS
+static dory_memory_statistics_t dory_memory_statistics;
+static void dory_L2_allocator_used(unsigned int L2_pointer_input_begin, unsigned int L2_pointer_input_end);
+#endif
 
 /* allocation and de-allocation functions for manually manage L2 and L1 memory.
    The allocation in L2 is made in a bidirectional way inside an allocator.
@@ -43,8 +51,11 @@ void dory_L2_alloc(unsigned int * L2_pointer_input_begin,
     *(L2_pointer_output) = *(L2_pointer_input_end) - memory_to_allocate;
     *(L2_pointer_input_end) = *(L2_pointer_input_end) - memory_to_allocate;    
   }
+#ifdef MEMORY_STATISTICS
+  dory_L2_allocator_used(*L2_pointer_input_begin, *L2_pointer_input_end);
+#endif
 #ifdef VERBOSE
-  printf("L2_pointer_input_begin %d, L2_pointer_input_end %d, L2_pointer_allocated %d with a memory of %d at the begin/end (1/0) %d\n", *L2_pointer_input_begin - 469810000, *L2_pointer_input_end - 469810000, *L2_pointer_output - 469810000, memory_to_allocate, begin_end_n);
+  printf("L2_pointer_input_begin %d, L2_pointer_input_end %d, L2_pointer_allocated %d with a memory of %d at the begin/end (1/0) %d\n", *L2_pointer_input_begin - L2_BASE, *L2_pointer_input_end - L2_BASE, *L2_pointer_output - L2_BASE, memory_to_allocate, begin_end_n);
   printf("End-in %d\n", *L2_pointer_input_end - *L2_pointer_input_begin);
 #endif
 }
@@ -64,8 +75,11 @@ void dory_L2_free(unsigned int * L2_pointer_input_begin,
   {
     *(L2_pointer_input_end) = *(L2_pointer_input_end) + memory_to_free;    
   }
+#ifdef MEMORY_STATISTICS
+  dory_L2_allocator_used(*L2_pointer_input_begin, *L2_pointer_input_end);
+#endif
 #ifdef VERBOSE
-  printf("L2_pointer_input_begin %d, L2_pointer_input_end %d, free a memory of %d at the begin/end (1/0) %d\n", *L2_pointer_input_begin - 469810000, *L2_pointer_input_end - 469810000, memory_to_free, begin_end_n);
+  printf("L2_pointer_input_begin %d, L2_pointer_input_end %d, free a memory of %d at the begin/end (1/0) %d\n", *L2_pointer_input_begin - L2_BASE, *L2_pointer_input_end - L2_BASE, memory_to_free, begin_end_n);
   printf("End-in %d\n", *L2_pointer_input_end - *L2_pointer_input_begin);
 #endif
 }
@@ -87,4 +101,100 @@ void dory_L1_free(unsigned int * L2_pointer_input_begin,
 {
     *(L2_pointer_input_begin) = *(L2_pointer_input_begin) - memory_to_free;
 
-}
\ No newline at end of file
+}
+
+#ifdef MEMORY_STATISTICS
+/* Watermarks of the memory used by the network, compiled only with -DMEMORY_STATISTICS (make MEMORY_STATISTICS=1).
+   L2 occupations are measured in bytes from the beginning of the L2 buffer of the network:
+   the network reports each L2 buffer used by a layer (dory_L2_used), the two-ended allocator its state at each
+   allocation/free. The layer functions report the end of the L1 buffers they use (dory_L1_used).
+   The table printed at the end of the network compares them with the values predicted at generation time.
+*/
+
+void dory_memory_statistics_init(unsigned int L2_base,
+              int L2_size,
+              int * L2_layer,
+              int * L1_layer,
+              int * L2_events,
+              int n_layers
+              )
+{
+  dory_memory_statistics.L2_base = L2_base;
+  dory_memory_statistics.L2_size = L2_size;
+  dory_memory_statistics.L2_current = 0;
+  dory_memory_statistics.L2_peak = 0;
+  dory_memory_statistics.L1_peak = 0;
+  dory_memory_statistics.layer = 0;
+  dory_memory_statistics.L2_layer = L2_layer;
+  dory_memory_statistics.L1_layer = L1_layer;
+  dory_memory_statistics.L2_events = L2_events;
+  for (int i = 0; i < n_layers; i++)
+  {
+    L2_layer[i] = 0;
+    L1_layer[i] = 0;
+    L2_events[i] = 0;
+  }
+}
+
+void dory_memory_statistics_layer(int layer)
+{
+  dory_memory_statistics.layer = layer;
+}
+
+static void dory_L2_watermark(int memory_used)
+{
+  int layer = dory_memory_statistics.layer;
+  dory_memory_statistics.L2_current = memory_used;
+  dory_memory_statistics.L2_events[layer]++;
+  if (memory_used > dory_memory_statistics.L2_layer[layer])
+    dory_memory_statistics.L2_layer[layer] = memory_used;
+  if (memory_used > dory_memory_statistics.L2_peak)
+    dory_memory_statistics.L2_peak = memory_used;
+}
+
+static void dory_L2_allocator_used(unsigned int L2_pointer_input_begin, unsigned int L2_pointer_input_end)
+{
+  // bytes allocated at the begin plus bytes allocated at the end of the buffer
+  dory_L2_watermark((L2_pointer_input_begin - dory_memory_statistics.L2_base) +
+                    (dory_memory_statistics.L2_base + dory_memory_statistics.L2_size - L2_pointer_input_end));
+}
+
+void dory_L2_used(unsigned int L2_pointer, int memory_used)
+{
+  dory_L2_watermark(L2_pointer + memory_used - dory_memory_statistics.L2_base);
+}
+
+void dory_L1_used(int memory_used)
+{
+  int layer = dory_memory_statistics.layer;
+  if (memory_used > dory_memory_statistics.L1_layer[layer])
+    dory_memory_statistics.L1_layer[layer] = memory_used;
+  if (memory_used > dory_memory_statistics.L1_peak)
+    dory_memory_statistics.L1_peak = memory_used;
+}
+
+void dory_memory_statistics_print(int n_layers,
+              int * L2_predicted, // NULL if no per layer prediction is available
+              int * L1_predicted,
+              int L1_size
+              )
+{
+  int errors = 0;
+  printf("\nMemory watermarks (bytes)\n");
+  printf("Layer  L2 used    L2 plan    L2 events  L1 used    L1 plan    Status\n");
+  for (int i = 0; i < n_layers; i++)
+  {
+    // L2 must stay within the plan and the buffer, L1 within the buffer: the L1 plan of the tiler excludes the kernel scratch
+    int overflow = dory_memory_statistics.L2_layer[i] > dory_memory_statistics.L2_size ||
+                   (L2_predicted != NULL && dory_memory_statistics.L2_layer[i] > L2_predicted[i]) ||
+                   dory_memory_statistics.L1_layer[i] > L1_size;
+    errors += overflow;
+    printf("%-6d %-10d %-10d %-10d %-10d %-10d %s\n", i,
+           dory_memory_statistics.L2_layer[i], L2_predicted != NULL ? L2_predicted[i] : dory_memory_statistics.L2_size,
+           dory_memory_statistics.L2_events[i],
+           dory_memory_statistics.L1_layer[i], L1_predicted[i], overflow ? "OVERFLOW" : "Ok");
+  }
+  printf("Peak L2: %d of %d, peak L1: %d of %d, %d layers out of plan\n", dory_memory_statistics.L2_peak, dory_memory_statistics.L2_size,
+         dory_memory_statistics.L1_peak, L1_size, errors);
+}
+#endif
@@ -37,4 +37,35 @@ void dory_L1_alloc(unsigned int * L2_pointer_input_begin,
 
 void dory_L1_free(unsigned int * L2_pointer_input_begin,
             int memory_to_free
-            );
\ No newline at end of file
+            );
+
+#ifdef MEMORY_STATISTICS
+// watermarks of the L2 and L1 memory, see mem_controller.c
+typedef struct {
+  unsigned int L2_base;  // beginning of the L2 buffer of the network
+  int L2_size;           // bytes of the L2 buffer
+  int L2_current;        // bytes in use: allocator state, or end of the last buffer used by the layer
+  int L2_peak;
+  int L1_peak;
+  int layer;             // layer in execution
+  int * L2_layer;        // per layer L2 watermark, L1 watermark and L2 allocation events,
+  int * L1_layer;        // arrays of n_layers elements owned by the network
+  int * L2_events;
+} dory_memory_statistics_t;
+
+void dory_memory_statistics_init(unsigned int L2_base,
+              int L2_size,
+              int * L2_layer,
+              int * L1_layer,
+              int * L2_events,
+              int n_layers
+              );
+void dory_memory_statistics_layer(int layer);
+void dory_L2_used(unsigned int L2_pointer, int memory_used);
+void dory_L1_used(int memory_used);
+void dory_memory_statistics_print(int n_layers,
+              int * L2_predicted, // NULL if no per layer prediction is available
+              int * L1_predicted,
+              int L1_size
+              );
+#endif
@@ -111,6 +111,17 @@ static int branch_last[${len(PULP_Nodes_Graph)}] = {\
 % endif
 % endfor
 };
+#ifdef MEMORY_STATISTICS
+// L2 and L1 watermarks of each layer, measured during the execution (see mem_controller.c)
+static int L2_used_layer[${len(PULP_Nodes_Graph)}];
+static int L1_used_layer[${len(PULP_Nodes_Graph)}];
+static int L2_events_layer[${len(PULP_Nodes_Graph)}];
+static int L1_dimension[${len(PULP_Nodes_Graph)}] = {\
+% for i in range(len(PULP_Nodes_Graph)):
+${PULP_Nodes_Graph[i].l1_dimensions}${'' if loop.last else ', '}\
+% endfor
+};
+#endif
 static int check_weights[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
 ${PULP_Nodes_Graph[i].check_sum_w}${'' if loop.last else ', '}\
@@ -540,6 +551,9 @@ void network_run()
 #ifdef VERBOSE
     printf("\nL2 Buffer alloc initial\t@ 0x%08x:\t%s\n", (unsigned int)L2_buffer_allocation, L2_buffer_allocation?"Ok":"Failed");
     printf("L1 Buffer alloc initial\t@ 0x%08x:\t%s\n\n", (unsigned int)l1_buffer, l1_buffer?"Ok":"Failed");
+#endif
+#ifdef MEMORY_STATISTICS
+    dory_memory_statistics_init((unsigned int) L2_buffer_allocation, ${l2_buffer_size}, L2_used_layer, L1_used_layer, L2_events_layer, ${len(PULP_Nodes_Graph)});
 #endif
   }
 /* ---------------------------------- */
@@ -635,6 +649,9 @@ int counter_for_size = 0;
   {
     if(pi_core_id()==0)
     {
+#ifdef MEMORY_STATISTICS
+      dory_memory_statistics_layer(i);
+#endif
       // copy of weights of next layers:
       // 1. copy only if we have to allocate the weights (hence not weights tiled from L3 and not pooling/add layer)
       // 2. waits before the read if we want to implement a double buffering, after if not. 
@@ -954,6 +971,10 @@ int counter_for_size = 0;
 /* ---------------------------------- */
 /* -------- SECTION 3 BEGIN --------- */
 /* ---------------------------------- */
+#ifdef MEMORY_STATISTICS
+  if (pi_core_id()==0)
+    dory_memory_statistics_print(${len(PULP_Nodes_Graph)}, NULL, L1_dimension, ${l1_buffer});
+#endif
 
 % if 'Perf_final' in verbose_level:
   int cid = pi_core_id();    
@@ -68,11 +68,19 @@ const char * L3_weights_files[] = {
 };
 int L3_weights_size[${weights_number}];
 static int L3_weights;
-static int L3_input;
-static int bypass_L3_input;
-static int L3_output;
-static int bypass_L3_output;
+static int L3_activations;
 static int activations_input;
+// offsets of the activations tiled to L3 in L3_activations, planned offline from their lifetimes
+static int L3_input_offset[${len(PULP_Nodes_Graph)}] = {\
+% for i in range(len(PULP_Nodes_Graph)):
+${PULP_Nodes_Graph[i].L3_input_offset}${'' if loop.last else ', '}\
+% endfor
+};
+static int L3_output_offset[${len(PULP_Nodes_Graph)}] = {\
+% for i in range(len(PULP_Nodes_Graph)):
+${PULP_Nodes_Graph[i].L3_output_offset}${'' if loop.last else ', '}\
+% endfor
+};
 static int L3_layers[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
 % if 'L3' in func_name[i]: 
@@ -111,49 +119,80 @@ static int L3_weights_layers[${len(PULP_Nodes_Graph)}] = {\
 };
 static int allocate_layer[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
-% if PULP_Nodes_Graph[i].L3_allocation!=1 and ('Gemm' in PULP_Nodes_Graph[i].name or 'Conv' in PULP_Nodes_Graph[i].name or 'MatMul' in PULP_Nodes_Graph[i].name): 
+% if PULP_Nodes_Graph[i].L3_allocation!=1 and PULP_Nodes_Graph[i].weights_resident == 0 and ('Gemm' in PULP_Nodes_Graph[i].name or 'Conv' in PULP_Nodes_Graph[i].name or 'MatMul' in PULP_Nodes_Graph[i].name): 
 1${'' if loop.last else ', '}\
 % else:
 0${'' if loop.last else ', '}\
 % endif
 % endfor
 };
-static int branch_input[${len(PULP_Nodes_Graph)}] = {\
+// layers whose weights are read once by network_setup and stay in L2 for all the inferences
+static int resident_layer[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
-% if PULP_Nodes_Graph[i].branch_in == 1:
-1${'' if loop.last else ', '}\
-% else:
-0${'' if loop.last else ', '}\
-% endif
+${PULP_Nodes_Graph[i].weights_resident}${'' if loop.last else ', '}\
+% endfor
+};
+// tensor table: activations of the network, the input first and then the output of each layer.
+// Layer producing each tensor (-1 for the network input), last layer reading it and its fixed offset in the L2 buffer,
+// computed at generation time from the lifetimes: nothing is allocated in L2 during the execution.
+static int tensor_producer[${len(tensors)}] = {\
+% for tensor in tensors:
+${tensor['producer']}${'' if loop.last else ', '}\
 % endfor
 };
-static int branch_output[${len(PULP_Nodes_Graph)}] = {\
+static int tensor_last_use[${len(tensors)}] = {\
+% for tensor in tensors:
+${tensor['last_use']}${'' if loop.last else ', '}\
+% endfor
+};
+static int tensor_L2_offset[${len(tensors)}] = {\
+% for tensor in tensors:
+${tensor['offset']}${'' if loop.last else ', '}\
+% endfor
+};
+static int tensor_size[${len(tensors)}] = {\
+% for tensor in tensors:
+${tensor['size']}${'' if loop.last else ', '}\
+% endfor
+};
+// tensors read and written by each layer: the second input is -1 for all the layers but Add
+static int layer_input[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
-% if PULP_Nodes_Graph[i].branch_out == 1:
-1${'' if loop.last else ', '}\
-% else:
-0${'' if loop.last else ', '}\
-% endif
+${PULP_Nodes_Graph[i].input_tensor}${'' if loop.last else ', '}\
 % endfor
 };
-static int branch_change[${len(PULP_Nodes_Graph)}] = {\
+static int layer_input_add[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
-% if PULP_Nodes_Graph[i].branch_change == 1:
-1${'' if loop.last else ', '}\
-% else:
-0${'' if loop.last else ', '}\
-% endif
+${PULP_Nodes_Graph[i].input_add_tensor}${'' if loop.last else ', '}\
 % endfor
 };
-static int branch_last[${len(PULP_Nodes_Graph)}] = {\
+static int layer_output[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
-% if PULP_Nodes_Graph[i].branch_last == 1:
-1${'' if loop.last else ', '}\
-% else:
-0${'' if loop.last else ', '}\
-% endif
+${PULP_Nodes_Graph[i].output_tensor}${'' if loop.last else ', '}\
+% endfor
+};
+// fixed offsets of the weights of each layer in the L2 buffer
+static int L2_weights_offset[${len(PULP_Nodes_Graph)}] = {\
+% for i in range(len(PULP_Nodes_Graph)):
+${PULP_Nodes_Graph[i].L2_weights_offset}${'' if loop.last else ', '}\
+% endfor
+};
+#ifdef MEMORY_STATISTICS
+// L2 and L1 watermarks of each layer, measured during the execution and predicted at generation time (see mem_controller.c)
+static int L2_used_layer[${len(PULP_Nodes_Graph)}];
+static int L1_used_layer[${len(PULP_Nodes_Graph)}];
+static int L2_events_layer[${len(PULP_Nodes_Graph)}];
+static int L2_extent[${len(PULP_Nodes_Graph)}] = {\
+% for i in range(len(PULP_Nodes_Graph)):
+${PULP_Nodes_Graph[i].L2_extent}${'' if loop.last else ', '}\
 % endfor
 };
+static int L1_dimension[${len(PULP_Nodes_Graph)}] = {\
+% for i in range(len(PULP_Nodes_Graph)):
+${PULP_Nodes_Graph[i].l1_dimensions}${'' if loop.last else ', '}\
+% endfor
+};
+#endif
 static int check_weights[${len(PULP_Nodes_Graph)}] = {\
 % for i in range(len(PULP_Nodes_Graph)):
 ${PULP_Nodes_Graph[i].check_sum_w}${'' if loop.last else ', '}\
@@ -382,21 +421,10 @@ void open_filesystem(struct pi_device *flash, struct pi_device *fs)
 int memId;
 char* L2_output;
 char* L2_input;
-char* L2_weights_1;
-char* L2_weights_2;
 char* L2_buffer_allocation;
-char* L2_buffer_tofree_copy;
-int L2_buffer_allocation_end;
 ${type} *l1_buffer;
-uint8_t * bypass_activations;
-uint8_t * activation_to_keep;
-char *exec_weights, *transfer_weights, *bypass_weights;
 int L3_weights_internal;
 //dronet modification moved the variable declarations here
-//
-char* L2_buffer_allocation_baseline;
-char* L2_buffer_allocation_end_baseline;
-//dronet modification added pointers to buffer allocation
 
 /* Moves the weights and the biases from hyperflash to hyperram */
 int network_setup()
@@ -410,13 +438,16 @@ int network_setup()
   pi_open_from_conf(&ram, &ram_conf);
   pi_ram_open(&ram);
   pi_fs_file_t *file;
-  pi_ram_alloc(&ram, &L3_weights, (uint32_t) 4800000);
-  pi_ram_alloc(&ram, &L3_input, (uint32_t) 1500000);
-  pi_ram_alloc(&ram, &L3_output, (uint32_t) 1500000);
+  // weights files followed by the network input
+  pi_ram_alloc(&ram, &L3_weights, (uint32_t) ${l3_weights_size});
+% if l3_activations_size > 0:
+  pi_ram_alloc(&ram, &L3_activations, (uint32_t) ${l3_activations_size});
+% endif
 #ifdef VERBOSE
     printf("\nL3 Buffer alloc initial\t@ %d:\t%s\n", (unsigned int)L3_weights, L3_weights?"Ok":"Failed");
-    printf("\nL3 Buffer alloc initial\t@ %d:\t%s\n", (unsigned int)L3_input, L3_input?"Ok":"Failed");
-    printf("\nL3 Buffer alloc initial\t@ %d:\t%s\n", (unsigned int)L3_output, L3_output?"Ok":"Failed");
+% if l3_activations_size > 0:
+    printf("\nL3 Buffer alloc initial\t@ %d:\t%s\n", (unsigned int)L3_activations, L3_activations?"Ok":"Failed");
+% endif
 #endif
   unsigned int rdDone = 0;
 % if 'Check_all' in verbose_level:
@@ -480,14 +511,15 @@ int network_setup()
   }
 
 
-  // Allocate L2 memory once-for-all
-  L2_buffer_allocation = (char*) pmsis_l2_malloc(410000);
-  L2_buffer_tofree_copy = L2_buffer_allocation;
-  L2_buffer_allocation_end = L2_buffer_allocation + 410000;
-  // Store baseline addresses. Needed in the while loop, at the beginning of each new inference
-  L2_buffer_allocation_baseline = L2_buffer_allocation;
-  L2_buffer_allocation_end_baseline = L2_buffer_allocation_end;
-  // Return L2 buffer. We use this space to write images captured by the camera
+  // Allocate L2 memory once-for-all: peak of the static L2 plan
+  L2_buffer_allocation = (char*) pmsis_l2_malloc(${l2_peak});
+% if any([node.weights_resident for node in PULP_Nodes_Graph]):
+  // resident weights: read from L3 only once
+  for (int i = 0; i < ${len(PULP_Nodes_Graph)}; i++)
+    if (resident_layer[i] == 1)
+      pi_ram_read(&ram, L3_weights + cumulative_weights_dimension[i], L2_buffer_allocation + L2_weights_offset[i], check_weights_dimension[i]);
+% endif
+  // Return L2 buffer. We use this space to write images captured by the camera: it is the input of the first layer
   return L2_buffer_allocation;
   //dronet modification: returning pointer to the allocated space
 }
@@ -557,49 +589,22 @@ void network_run(unsigned int L3_weights_size)
   uint16_t out_shift = 0;
   uint16_t inmul1 = 0;
   uint16_t inmul2 = 0;
-  int branch_active = 0;
-  int branch_keep_active = 0;
-  int counter = 0;
-  int counter_keep = 0;
-  int valid = 0;
-  static int keeping = 0;
-  static int activation_to_keep_delloced = 0;
-  int branch_output_index = 0;
-  static int keep_index = 0;
-  bypass_activations = 0;
-  activation_to_keep = 0;
-  int bypass_dimension = 0;
-  int bypass_to_dealloc = 0;
-  int activation_dimension = 0;
-  int d_buffering_weights_t = 0;
-  int error_presence = 0;
-  int bypass_side = 0;
-  int bypass_used_as_out = 0;
-  int input_used_as_out = 0;
-  int valid_keep = 0;
-  int bypass_side_keep = 0;
-  int d_buffering_weights_e = 0;
-  int d_buffering_inputs = 0;
-  int d_buffering_outputs = 0;
-  int begin_end_n = 1;
   pi_cl_ram_req_t buff_req1;
+  // weights are read from L3 up to ${prefetch_depth} layers ahead: the request of layer j is weights_req[j % ${prefetch_depth + 1}],
+  // free again since the layer j - ${prefetch_depth + 1} has waited for its own weights.
+  pi_cl_ram_req_t weights_req[${prefetch_depth + 1}];
+  int next_prefetch = 1;
   L3_weights_internal = L3_weights;
-  transfer_weights = d_buffering_weights_t ? L2_weights_2 : L2_weights_1;
-  exec_weights = d_buffering_weights_e ? L2_weights_2 : L2_weights_1;
-  bypass_weights = d_buffering_weights_e ? L2_weights_2 : L2_weights_1;
-  pi_cl_alloc_req_t alloc_req = {0};
-  pi_cl_free_req_t free_req = {0};
   if (pi_core_id()==0)
   {
-    // Restore original addresses
-    L2_buffer_allocation = L2_buffer_allocation_baseline;
-    L2_buffer_allocation_end = L2_buffer_allocation_end_baseline;
     // Allocate L1 buffer
-
     l1_buffer = pmsis_l1_malloc((uint32_t) ${l1_buffer});
 #ifdef VERBOSE
     printf("\nL2 Buffer alloc initial\t@ 0x%08x:\t%s\n", (unsigned int)L2_buffer_allocation, L2_buffer_allocation?"Ok":"Failed");
     printf("L1 Buffer alloc initial\t@ 0x%08x:\t%s\n\n", (unsigned int)l1_buffer, l1_buffer?"Ok":"Failed");
+#endif
+#ifdef MEMORY_STATISTICS
+    dory_memory_statistics_init((unsigned int) L2_buffer_allocation, ${l2_peak}, L2_used_layer, L1_used_layer, L2_events_layer, ${len(PULP_Nodes_Graph)});
 #endif
   }
 /* ---------------------------------- */
@@ -608,7 +613,7 @@ void network_run(unsigned int L3_weights_size)
 
 /* 
   - initial copies from L3 of input
-  - copies of weights of first 2 layers
+  - copy of weights of the first layer
 */
 /* ---------------------------------- */
 /* -------- SECTION 1 BEGIN --------- */
@@ -616,66 +621,23 @@ void network_run(unsigned int L3_weights_size)
   if(pi_core_id()==0)
   {
 /* 
-  - input allocation and copy
+  - input copy
 */
+    L2_input = L2_buffer_allocation + tensor_L2_offset[layer_input[0]];
 % if test:
-    dory_L2_alloc(&L2_buffer_allocation,
-      &L2_buffer_allocation_end,
-      &L2_input,
-      ${int(PULP_Nodes_Graph[0].input_activation_dimensions* BitIn / 8.0 * 2)}, // dronet modification: multiplied allocation by 2
-      begin_end_n // begin is 1, end is 0
-      );
 #ifdef CHECKSUMS
     pi_cl_ram_read(&ram, activations_input, L2_input, ${int(PULP_Nodes_Graph[0].input_activation_dimensions* BitIn / 8.0)}, &buff_req1);
     pi_cl_ram_read_wait(&buff_req1);
 #endif     
     //dronet modification: added a if condition to doublecheck checksums
-% else:
-    dory_L2_alloc(&L2_buffer_allocation,
-      &L2_buffer_allocation_end,
-      &L2_input,
-      ${int(PULP_Nodes_Graph[0].input_activation_dimensions* BitIn / 8.0)},
-      begin_end_n // begin is 1, end is 0
-      );
 % endif
 /* 
-  - first layer weights allocation and copy
+  - first layer weights copy
 */
-    dory_L2_alloc(&L2_buffer_allocation,
-      &L2_buffer_allocation_end,
-      &L2_weights_1,
-      ${int(PULP_Nodes_Graph[0].weights_dimension* BitW / 8.0)},
-      begin_end_n // begin is 1, end is 0
-      );
-    begin_end_n = !begin_end_n;
-    transfer_weights = L2_weights_1;
-    exec_weights = L2_weights_1;  
-    pi_cl_ram_read(&ram, L3_weights_internal, transfer_weights, ${int(PULP_Nodes_Graph[0].weights_dimension* BitW / 8.0)}, &buff_req1);
+% if PULP_Nodes_Graph[0].weights_resident == 0:
+    pi_cl_ram_read(&ram, L3_weights_internal, L2_buffer_allocation + L2_weights_offset[0], ${int(PULP_Nodes_Graph[0].weights_dimension* BitW / 8.0)}, &buff_req1);
     pi_cl_ram_read_wait(&buff_req1);
-/* 
-  - output of the first layer allocation
-*/
-    dory_L2_alloc(&L2_buffer_allocation,
-      &L2_buffer_allocation_end,
-      &L2_output,
-      ${int(PULP_Nodes_Graph[0].output_activation_dimensions* BitOut / 8.0)},
-      begin_end_n // begin is 1, end is 0
-      );
-% if 'Gemm' in PULP_Nodes_Graph[1].name or 'Conv' in PULP_Nodes_Graph[1].name:
-/* 
-  - second layer weights allocation
-*/
-    d_buffering_weights_t = !d_buffering_weights_t;
-    if(L2_output == NULL) return -1;
-    dory_L2_alloc(&L2_buffer_allocation,
-      &L2_buffer_allocation_end,
-      &L2_weights_2,
-      ${int(PULP_Nodes_Graph[1].weights_dimension* BitW / 8.0)}- ${int(PULP_Nodes_Graph[0].weights_dimension* BitW / 8.0)},
-      begin_end_n // begin is 1, end is 0
-      );
-    transfer_weights = d_buffering_weights_t ? L2_weights_2 : L2_weights_1;
-    % endif
-    begin_end_n = !begin_end_n;
+% endif
   }
 /* ---------------------------------- */
 /* --------- SECTION 1 END ---------- */ 
@@ -698,45 +660,52 @@ void network_run(unsigned int L3_weights_size)
     if(pi_core_id()==0)
     {
       // copy of weights of next layers:
-      // 1. copy only if we have to allocate the weights (hence not weights tiled from L3 and not pooling/add layer)
-      // 2. waits before the read if we want to implement a double buffering, after if not. 
-      // Waiting based on the fact if layer need or not transfers from L3 memory.
-      if(i < ${len(PULP_Nodes_Graph)-1})
+      // 1. copy only if we have to allocate the weights (hence not weights tiled from L3 and not pooling/add layer),
+      //    up to ${prefetch_depth} layers ahead, in the L2 buffers planned free from now to their layer
+      // 2. layers tiled from L3 use the HyperRAM themselves: the prefetches are completed before they start.
+      // 3. each layer waits only for its own weights.
+      for (; next_prefetch < ${len(PULP_Nodes_Graph)} && next_prefetch <= i + ${prefetch_depth}; next_prefetch++)
       {
-        if (allocate_layer[i+1] == 1)
-        {
-          if (L3_layers[i-1] == 0 && i > 0)
-            pi_cl_ram_read_wait(&buff_req1);
-          pi_cl_ram_read(&ram, L3_weights_internal + cumulative_weights_dimension[i+1], transfer_weights, check_weights_dimension[i+1], &buff_req1);
-          if (L3_layers[i] == 1)
-            pi_cl_ram_read_wait(&buff_req1);
-        }
+        if (allocate_layer[next_prefetch] == 1)
+          pi_cl_ram_read(&ram, L3_weights_internal + cumulative_weights_dimension[next_prefetch], L2_buffer_allocation + L2_weights_offset[next_prefetch], check_weights_dimension[next_prefetch], &weights_req[next_prefetch % ${prefetch_depth + 1}]);
       }
+      if (L3_layers[i] == 1)
+      {
+        for (int j = i + 1; j < next_prefetch; j++)
+          if (allocate_layer[j] == 1)
+            pi_cl_ram_read_wait(&weights_req[j % ${prefetch_depth + 1}]);
+      }
+      if (i > 0 && allocate_layer[i] == 1)
+        pi_cl_ram_read_wait(&weights_req[i % ${prefetch_depth + 1}]);
+      L2_input = L2_buffer_allocation + tensor_L2_offset[layer_input[i]];
+      L2_output = L2_buffer_allocation + tensor_L2_offset[layer_output[i]];
+#ifdef MEMORY_STATISTICS
+      // tensors live during the layer, its weights and the weights of the next layers being prefetched
+      dory_memory_statistics_layer(i);
+      for (int t = 0; t < ${len(tensors)}; t++)
+        if (tensor_producer[t] <= i && i <= tensor_last_use[t])
+          dory_L2_used(L2_buffer_allocation + tensor_L2_offset[t], tensor_size[t]);
+      if (allocate_layer[i] == 1)
+        dory_L2_used(L2_buffer_allocation + L2_weights_offset[i], check_weights_dimension[i]);
+      for (int j = 0; j < ${len(PULP_Nodes_Graph)}; j++)
+        if (resident_layer[j] == 1)
+          dory_L2_used(L2_buffer_allocation + L2_weights_offset[j], check_weights_dimension[j]);
+      for (int j = i + 1; j < next_prefetch; j++)
+        if (allocate_layer[j] == 1)
+          dory_L2_used(L2_buffer_allocation + L2_weights_offset[j], check_weights_dimension[j]);
+#endif
     }
       
 % if verbose_level == 'Check_all+Perf_final':
 #ifdef VERBOSE
     if(pi_core_id()==0)
     {
-      if(branch_change[i-1] == 1 && i > 0)
-      {
-        check_layer(bypass_activations,check_activations[branch_output_index+1],check_activations_dimension[branch_output_index+1]);
-      }
+      if (L3_input_layers[i]==1)
+        printf("In in L3\n");
       else
-      {
-        if (L3_input_layers[i]==1)
-          printf("In in L3\n");
-        else
-          check_layer(L2_input, check_activations[i], check_activations_dimension[i]);
-      }
-      if(branch_input[i] == 1 && keeping == 1)
-      {
-        check_layer(activation_to_keep, check_activations_out[keep_index],check_activations_out_dimension[keep_index]);
-      }
-      else if (branch_input[i] == 1 && keeping == 0)
-      {
-        check_layer(bypass_activations,check_activations[branch_output_index+1],check_activations_dimension[branch_output_index+1]);
-      }
+        check_layer(L2_input, check_activations[i], check_activations_dimension[i]);
+      if (layer_input_add[i] >= 0 && tensor_producer[layer_input_add[i]] >= 0)
+        check_layer(L2_buffer_allocation + tensor_L2_offset[layer_input_add[i]], check_activations_out[tensor_producer[layer_input_add[i]]], tensor_size[layer_input_add[i]]);
     }
 #endif  
 % endif
@@ -745,29 +714,19 @@ void network_run(unsigned int L3_weights_size)
     inmul1 = inmul1_vector[i];
     inmul2 = inmul2_vector[i];
     pi_cl_team_barrier(0);
-    unsigned int args[13] = {L3_input,
-      L3_output,
+    unsigned int args[13] = {L3_activations + L3_input_offset[i],
+      L3_activations + L3_output_offset[i],
       L3_weights_internal + cumulative_weights_dimension[i],
       L2_input,
-      bypass_activations,
+      L2_buffer_allocation + (layer_input_add[i] >= 0 ? tensor_L2_offset[layer_input_add[i]] : 0),
       L2_output,
-      exec_weights,
+      L2_buffer_allocation + L2_weights_offset[i],
       l1_buffer,
       &ram,
       out_mult,
       inmul1,
       inmul2, 
       out_shift};
-    if (branch_change[i-1] == 1 && branch_input[i] == 0)
-    {
-      args[0] = bypass_L3_input;
-      args[1] = bypass_L3_output;
-      args[3] = bypass_activations;
-    }
-    if(branch_input[i] == 1 && keeping == 1)
-    {
-      args[4] = activation_to_keep;
-    }
 % if 'Yes' in performance or 'Perf_final' in verbose_level:  
     // perf measurement begin
     pi_perf_conf(1<<PI_PERF_CYCLES);          
@@ -837,17 +796,6 @@ void network_run(unsigned int L3_weights_size)
 #endif
     }
 
-    // prevents error from compiler
-    if (pi_core_id()==0)
-    {
-      asm volatile("": : :"memory");
-      unsigned int temp = L3_input;
-      L3_input = L3_output;
-      asm volatile("": : :"memory");
-      L3_output = temp;
-      asm volatile("": : :"memory");
-    }
-
 % if verbose_level == 'Check_all+Perf_final':
 #ifdef VERBOSE
     if(pi_core_id()==0)
@@ -882,159 +830,6 @@ void network_run(unsigned int L3_weights_size)
     }     
 #endif   
 % endif
-    if(branch_change[i] == 1)
-    {
-      keep_index = i;
-    }
-    if (i < ${len(PULP_Nodes_Graph) - 1})
-    {
-      if(pi_core_id()==0)
-      {
-        if (branch_input[i] == 1)
-        {
-          valid = 1;
-          valid_keep = 1;
-        }
-
-        // deallocation of weights
-        if (layer_with_weights[i] == 1)
-          dory_L2_free(&L2_buffer_allocation,
-            &L2_buffer_allocation_end,
-            check_weights_dimension[i],
-            begin_end_n // begin is 1, end is 0
-            );
-        if (layer_with_weights[i+1] == 1)
-        {
-          d_buffering_weights_e = !d_buffering_weights_e;
-          exec_weights = d_buffering_weights_e ? L2_weights_2 : L2_weights_1;
-        }
-        // deallocation of input if not part of a residual connection
-        //IT CAN NOT WORK FOR SOME CASES!!!
-        if ((branch_output[i-1] !=1 && branch_change[i-1] != 1) && input_used_as_out!=1 || i==0)
-        {
-          dory_L2_free(&L2_buffer_allocation,
-            &L2_buffer_allocation_end,
-            check_activations_dimension[i],
-            begin_end_n // begin is 1, end is 0
-            );
-   
-        }
-          
-        // deallocation of a residual activation previously stored
-        if(valid_keep == 1 && keeping == 1 && bypass_side_keep==begin_end_n && bypass_used_as_out!=1)
-        {
-          dory_L2_free(&L2_buffer_allocation,
-            &L2_buffer_allocation_end,
-            activation_dimension,
-            begin_end_n // begin is 1, end is 0
-            );
-          counter_keep = 0;
-          branch_keep_active = 0;
-          keeping = 0;
-          activation_to_keep_delloced = 0;
-        }
-        // MUST MAKE SURE THAT ACTIVATION_TO_KEEP IS NOT INFRONT OF BYPASS AND THAT IT IS
-        // SAFE TO DEALLOC BYPASS ACTIVATION. IT'S MOST LIKELY ONLY DONE WHEN ON ADD LAYER
-        if (branch_input[i]==1 && bypass_to_dealloc == 1)
-        {
-          dory_L2_free(&L2_buffer_allocation,
-            &L2_buffer_allocation_end,
-            bypass_dimension,
-            begin_end_n // begin is 1, end is 0
-            );
-          counter = 0;
-          branch_active = 0;
-          bypass_to_dealloc = 0;
-        }
-        // Keep last layer of left side until add layer is encountered.
-        if (branch_change[i] == 1 && branch_output[i] == 0 && branch_last[i] == 0)
-        {
-          activation_to_keep = L2_output;
-          activation_dimension = check_activations_out_dimension[i];
-          keeping = 1;
-          branch_keep_active = 1;
-          activation_to_keep_delloced = 1;
-          bypass_side_keep = !begin_end_n; 
-          valid_keep = 0;
-        }
-        if (branch_output[i] == 1)
-        {
-          bypass_L3_input = L3_input;
-          bypass_L3_output = L3_output;
-          branch_output_index = i;
-          bypass_activations = L2_output;
-          bypass_dimension = check_activations_out_dimension[i];
-          branch_active = 1;
-          bypass_to_dealloc = 1;    
-          bypass_side = !begin_end_n;   
-          valid = 0;
-        }
-        L2_input = L2_output;
-        // allocation of output feature space
-        if (branch_input[i+1]!=1 || (branch_input[i+1]==1 && bypass_side != begin_end_n && keeping == 0))
-        {
-          dory_L2_alloc(&L2_buffer_allocation,
-            &L2_buffer_allocation_end,
-            &L2_output,
-            check_activations_out_dimension[i+1],
-            begin_end_n // begin is 1, end is 0
-            );
-          input_used_as_out = 0; 
-          bypass_used_as_out = 0; 
-        }
-        else if (keeping == 1) 
-        {
-          if (bypass_side_keep == begin_end_n)
-          {
-            L2_output = L2_input;
-            input_used_as_out = 1;
-          }
-          else
-          {
-            L2_output = activation_to_keep;
-            keeping = 0;
-          }
-        }
-        else
-        {
-          L2_output = bypass_activations;
-          bypass_used_as_out = 1;
-          bypass_to_dealloc = 0;
-        }
-        if (i < ${len(PULP_Nodes_Graph) - 2})
-        {
-          if (branch_input[i+1]==1 && bypass_side_keep == begin_end_n && keeping==1)
-            begin_end_n = !begin_end_n;
-          // allocation of weights for next next layer, if necessary.
-          if (layer_with_weights[i+2] == 1)
-          {
-            if (d_buffering_weights_e==1)
-            {
-              dory_L2_alloc(&L2_buffer_allocation,
-                &L2_buffer_allocation_end,
-                &L2_weights_1,
-                check_weights_dimension[i+2],
-                begin_end_n // begin is 1, end is 0
-                );
-            }
-            else
-            {
-              dory_L2_alloc(&L2_buffer_allocation,
-                &L2_buffer_allocation_end,
-                &L2_weights_2,
-                check_weights_dimension[i+2],
-                begin_end_n // begin is 1, end is 0
-                );
-            }
-            d_buffering_weights_t = !d_buffering_weights_t;
-            transfer_weights = d_buffering_weights_t ? L2_weights_2 : L2_weights_1;
-          }
-        }
-        //switching output and input in the buffer for allocation.
-        begin_end_n = !begin_end_n;
-      }
-
-    }
   }
 /* ---------------------------------- */
 /* --------- SECTION 2 END ---------- */
@@ -1043,6 +838,10 @@ void network_run(unsigned int L3_weights_size)
 /* ---------------------------------- */
 /* -------- SECTION 3 BEGIN --------- */
 /* ---------------------------------- */
+#ifdef MEMORY_STATISTICS
+  if (pi_core_id()==0)
+    dory_memory_statistics_print(${len(PULP_Nodes_Graph)}, L2_extent, L1_dimension, ${l1_buffer});
+#endif
 
 % if 'Perf_final' in verbose_level:
   #ifdef CYCLES_PRINT
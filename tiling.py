@@ -33,13 +33,71 @@ from template import print_template_layer
 from template import print_template_layer_1D
 from template import print_template_layer_L3
 from template import print_pool_template_layer_L3
+from template import print_template_layer_fused
+from tiling_cache import cached_tiling
 import logging
 import os
 import sys
+import time
+
+# layers whose L2-L1 search space has at most this number of (tile_n_out, tile_h, tile_w) candidates are tiled by enumeration
+ENUMERATIVE_TILER_LIMIT = 100000
+# layers tiled and seconds spent by the two L2-L1 tilers of the conv2d like layers (cache hits excluded).
+# 'CP baseline': layers tiled by enumeration also solved, only to time it, by the CP model (Tiling cp_baseline).
+TILER_STATISTICS = {'enumeration': [0, 0.], 'CP': [0, 0.], 'CP baseline': [0, 0.]}
+
+
+def print_tiler_statistics():
+    enumerated, enumeration_time = TILER_STATISTICS['enumeration']
+    solved, solver_time = TILER_STATISTICS['CP']
+    stringa = ("L2-L1 tiler: " + str(enumerated) + " layers by enumeration in %.3f s, " % enumeration_time +
+               str(solved) + " layers with the CP solver in %.3f s" % solver_time)
+    baseline, baseline_time = TILER_STATISTICS['CP baseline']
+    if enumerated > 0 and baseline == enumerated:
+        stringa += ". Saved %.3f s of CP solver on the enumerated layers" % (baseline_time - enumeration_time)
+    elif enumerated > 0:
+        # the layers left to the solver have the largest search spaces: not a sample to extrapolate from
+        stringa += ". No CP baseline measured for the enumerated layers (tiler_baseline = 'Yes' to measure the time saved)"
+    print(stringa)
+
+class List_handler(logging.Handler):
+    # keeps the messages logged by a worker process of run_tiling_job
+    def __init__(self, messages):
+        logging.Handler.__init__(self)
+        self.messages = messages
+
+    def emit(self, record):
+        self.messages.append(record.getMessage())
+
+
+def run_tiling_job(tile_gen, kwargs):
+    # Tiling and generation of a layer in a worker process of Model_deployment.run_tiling_jobs.
+    # The log, the exploration points and the statistics of the layer are returned with the tiling,
+    # to be merged by the main process in the layer order.
+    messages = []
+    log = logging.getLogger()
+    for hdlr in log.handlers[:]:
+        log.removeHandler(hdlr)
+    log.addHandler(List_handler(messages))
+    for method in TILER_STATISTICS.keys():
+        TILER_STATISTICS[method] = [0, 0.]
+    if tile_gen.cache is not None:
+        tile_gen.cache.hits = 0
+        tile_gen.cache.misses = 0
+    if tile_gen.exploration is not None:
+        tile_gen.exploration.layers = []
+    tiling = tile_gen.get_tiling(**kwargs)
+    return {'tiling': tiling,
+            'inplace_offset': tile_gen.inplace_offset,
+            'log': messages,
+            'statistics': TILER_STATISTICS,
+            'cache': (tile_gen.cache.hits, tile_gen.cache.misses) if tile_gen.cache is not None else (0, 0),
+            'exploration': tile_gen.exploration.layers if tile_gen.exploration is not None else []}
+
 
 class Tiling():
     # Class to generate the Tiling of the layer.
-    def __init__(self, module, out_ch, filter_size, stride, padding, groups, x_shape, L1_buffer, L2_buffer, platform, chip, test_location, BitIn, BitW, BitOut, BitActivation, optional_type, sdk, dma_parallelization):
+    def __init__(self, module, out_ch, filter_size, stride, padding, groups, x_shape, L1_buffer, L2_buffer, platform, chip, test_location, BitIn, BitW, BitOut, BitActivation, optional_type, sdk, dma_parallelization, cache=None, cost_model=None, exploration=None, cp_baseline=False):
         self.module = module
         self.out_ch = out_ch
         self.filter_size = filter_size
@@ -59,6 +117,14 @@ class Tiling():
         self.optional_type = optional_type
         self.sdk = sdk
         self.dma_parallelization = dma_parallelization
+        self.cache = cache
+        self.cost_model = cost_model
+        self.exploration = exploration
+        # the layers tiled by enumeration are also solved by the CP model, to report the time saved
+        self.cp_baseline = cp_baseline
+        # distance in bytes of the L2 output after the L2 input at which the layer can write its output
+        # over its own input (see inplace_output_offset). None if the output needs its own buffer.
+        self.inplace_offset = None
 
     def get_tiling(self, **kwargs):
         # This function is used to create the tiling of either a convolutional layer or a fully connected or a pooling layer.
@@ -66,6 +132,8 @@ class Tiling():
         try:
             if 'Conv1D' in self.module:
                 return self.get_tiling_conv1d(**kwargs)
+            elif 'Fused' in self.module:
+                return self.get_tiling_fused(**kwargs)
             elif 'Conv' in self.module:
                 return self.get_tiling_conv2d(**kwargs)
             elif 'Pool' in self.module:
@@ -758,6 +826,7 @@ class Tiling():
             return in_dim1, out_dim1, weights_dim, L1_tiles_size 
         return None
 
+    @cached_tiling
     def get_tiling_pool2d_L3(self,
                       BN,
                       input_L3,
@@ -880,6 +949,25 @@ class Tiling():
         return None
 
 
+    def get_L3_loop_order(self, n_tile_W, n_tile_x, n_tile_y, input_L3, input_dim, output_dim, weight_dim):
+        # HyperRAM traffic (bytes) of the two loop nests of layer_template_L3.c when both weights and activations are tiled.
+        # activations outer: each activation tile is read once, weights are read again for each activation tile.
+        # weights outer: weights are read once, input tiles are read again for each weight tile.
+        n_tile_act = n_tile_x if n_tile_x > 1 else n_tile_y
+        if n_tile_x > 1 or input_L3 == 1:
+            x_traffic = input_dim
+        else:
+            x_traffic = 0
+        y_traffic = output_dim if n_tile_y > 1 else 0
+        traffic = {}
+        traffic['activations'] = x_traffic + y_traffic + weight_dim * n_tile_act
+        traffic['weights'] = x_traffic * (n_tile_W if n_tile_x > 1 else 1) + y_traffic + weight_dim
+        # with tiled outputs, only complete output tiles (all channels) can be written back to L3
+        if n_tile_y > 1 or traffic['activations'] <= traffic['weights']:
+            return 'activations', traffic
+        return 'weights', traffic
+
+    @cached_tiling
     def get_tiling_conv2d_L3(self,
                       DW,
                       BN,
@@ -1070,6 +1158,133 @@ class Tiling():
         os._exit(0)
         return None
 
+    def multiple_buffering_candidates(self, DW, multiple_buffering_factor):
+        # depths of the L1 buffer ring explored by the tiler, in order of preference.
+        # Deeper rings only pay off with asynchronous DMA (GAP8v3; depthwise layers use blocking transfers),
+        # and each DMA issuing core keeps N-1 mchan transfer ids alive, out of the 16 of the cluster DMA.
+        if self.cost_model is None or DW == 1 or self.chip != 'GAP8v3' or multiple_buffering_factor != 2:
+            return [multiple_buffering_factor]
+        cores = 8 if self.dma_parallelization == '8-cores' else 1
+        return [n_buffers for n_buffers in range(2, 5) if cores * (n_buffers - 1) <= 16]
+
+    def conv2d_l1_occupation(self, DW, BN, fs1, fs2, padding_top, padding_bottom, n_out,
+                             tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out,
+                             db, name, BN_whole=0, hwc_to_chw_L1=0):
+        # L1 occupation of layer_template.c in bits, multiplied by 32 to keep the sub-byte datasizes integer.
+        # Works both with python integers and with the CP variables of get_tiling_conv2d_like.
+        # Slots as in template.py: weights, k and lambda are loaded once if the output channels are not tiled,
+        # the output of depthwise layers is written back before the next tile and the kernel scratch
+        # (im2col, full precision weights of depthwise) is a single buffer.
+        # BN_whole: k and lambda of all the output channels in L1 (see bn_whole_layer).
+        # hwc_to_chw_L1: one more input tile, the CHW copy of the depthwise input (see hwc_to_chw_layer), and the
+        # alignment to 4 bytes of the copy and of the input slots.
+        ds_x_scale = int(math.floor(32 * self.BitIn))
+        ds_y_scale = int(math.floor(32 * self.BitOut))
+        ds_W_scale = int(math.floor(32 * self.BitW))
+        ds_bn_scale = int(math.floor(32 * self.BitActivation))
+        db_W = db - (tile_n_out == n_out) * (db - 1)
+        db_y = 1 if DW == 1 else db
+        constr_in = db * ds_x_scale * tile_n_in * tile_h_in * tile_w_in
+        constr_out = db_y * ds_y_scale * tile_n_out * tile_h_out * tile_w_out
+        if DW == 0:
+            constr_weight = db_W * ds_W_scale * tile_n_in * tile_n_out * fs1 * fs2
+            constr_im2col = 32 * 8 * 2 * 8 * fs1 * fs2 * tile_n_in
+        else:
+            constr_weight = db_W * ds_W_scale * tile_n_in * fs1 * fs2
+            constr_im2col = 32 * 8 * 8 * ( fs1 * (tile_h_in + padding_top + padding_bottom) + fs1) * int( 8 / min(self.BitIn, self.BitOut, self.BitW))
+            constr_weight_full_prec = 32 * 8 * 8 * fs1 * fs2 * int( 8 / min(self.BitIn, self.BitOut, self.BitW))
+            if self.BitW==8:
+                constr_weight_full_prec = 0
+        if 'MatMul' in name or 'Gemm' in name:
+            constr_im2col = 0
+        if BN_whole == 1:
+            constr_bn = ds_bn_scale * n_out * 2
+        else:
+            constr_bn = ds_bn_scale * tile_n_out * 2 * db_W
+        constraint_all = constr_in + constr_out + constr_weight + constr_bn + constr_im2col + 20
+        if DW == 1:
+            constraint_all += constr_weight_full_prec
+        if DW == 1 and hwc_to_chw_L1 == 1:
+            constraint_all += ds_x_scale * tile_n_in * tile_h_in * tile_w_in + 32 * 8 * (4 + 3 * db)
+        if BN == 0:
+            constraint_all -= constr_bn
+        return constraint_all
+
+    def bn_whole_layer(self, DW, BN, fs1, fs2, padding_top, padding_bottom, n_out, h_out, w_out,
+                       tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name):
+        # 1 if k and lambda of all the output channels fit in L1 together with the tiles of the solution:
+        # layer_template.c then loads them once before the tile loop instead of with each weight tile.
+        # They must also fit a single DMA command (16 bits size).
+        if BN == 0 or int(n_out * self.BitActivation / 8) >= 65536:
+            return 0
+        n_tiles = int(math.ceil(n_out / tile_n_out) * math.ceil(h_out / tile_h_out) * math.ceil(w_out / tile_w_out))
+        db = 1 if n_tiles == 1 else multiple_buffering_factor
+        return int(self.conv2d_l1_occupation(DW, BN, fs1, fs2, padding_top, padding_bottom, n_out,
+                                             tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out,
+                                             db, name, BN_whole=1) <= 32 * self.buffer_size * 8)
+
+    def hwc_to_chw_layer(self, DW, BN, fs1, fs2, s, padding_top, padding_bottom, n_in, n_out, h_in, h_out, w_out,
+                         tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name):
+        # 1 if the input tiles of a depthwise layer are copied in their HWC layout, one 2d command per row, and transposed
+        # to CHW by the cluster cores in L1 (dory_hwc_to_chw) instead of by the DMA, one strided transfer per channel.
+        # Chosen by the cost model, for 8 bits inputs, when the CHW copy of a tile fits in L1 with the tiles of the solution.
+        if DW == 0 or self.cost_model is None or self.BitIn != 8:
+            return 0
+        n_tiles = int(math.ceil(n_out / tile_n_out) * math.ceil(h_out / tile_h_out) * math.ceil(w_out / tile_w_out))
+        db = 1 if n_tiles == 1 else multiple_buffering_factor
+        BN_whole = self.bn_whole_layer(DW, BN, fs1, fs2, padding_top, padding_bottom, n_out, h_out, w_out,
+                                       tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name)
+        if self.conv2d_l1_occupation(DW, BN, fs1, fs2, padding_top, padding_bottom, n_out,
+                                     tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out,
+                                     db, name, BN_whole=BN_whole, hwc_to_chw_L1=1) > 32 * self.buffer_size * 8:
+            return 0
+        family = self.cost_model.kernel_family(name, DW, fs1, fs2, s)
+        cycles = [self.cost_model.conv_layer_cycles(family, DW, BN,
+                      n_in, n_out, h_in, h_out, w_out,
+                      tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                      fs1, fs2, self.BitIn, self.BitOut, self.BitW, self.BitActivation,
+                      db, self.dma_parallelization, hwc_to_chw_L1=hwc_to_chw_L1) for hwc_to_chw_L1 in [0, 1]]
+        return int(cycles[1] < cycles[0])
+
+    def get_tiling_conv2d_like_enumerative(self, DW, fs1, fs2, s, padding, BN, n_in, n_out, h_in, w_in, h_out, w_out, db, name):
+        # Exhaustive search of the L2-L1 tiling with the fewest predicted cycles, with the constraints of the CP model
+        # of get_tiling_conv2d_like. Only the smallest tile for each number of tiles is visited (see tile_sizes), so
+        # pointwise, depthwise and fully connected layers have at most a few thousands candidates.
+        # Returns None without a cost model, above ENUMERATIVE_TILER_LIMIT candidates or if nothing fits L1.
+        if self.cost_model is None:
+            return None
+        padding_top, padding_bottom, padding_left, padding_right = padding
+        n_sizes = self.tile_sizes(n_out, int(8 / min(self.BitIn, self.BitOut, self.BitW)))
+        if DW == 1 and h_in <= 32 and w_in <= 32:
+            h_pairs = [(h_in, h_out)]
+            w_pairs = [(w_in, w_out)]
+        else:
+            h_pairs = self.tile_pairs(h_in, h_out, fs1, s, padding_top, padding_bottom)
+            w_pairs = self.tile_pairs(w_in, w_out, fs2, s, padding_left, padding_right)
+        if len(n_sizes) * len(h_pairs) * len(w_pairs) > ENUMERATIVE_TILER_LIMIT:
+            return None
+        family = self.cost_model.kernel_family(name, DW, fs1, fs2, s)
+        best_cycles = None
+        best_tiling = None
+        for tile_n_out in n_sizes:
+            tile_n_in = tile_n_out if DW == 1 else n_in
+            for tile_h_in, tile_h_out in h_pairs:
+                for tile_w_in, tile_w_out in w_pairs:
+                    if self.conv2d_l1_occupation(DW, BN, fs1, fs2, padding_top, padding_bottom, n_out,
+                                                 tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out,
+                                                 db, name) > 32 * self.buffer_size * 8:
+                        continue
+                    cycles = self.cost_model.conv_layer_cycles(family, DW, BN,
+                        n_in, n_out, h_in, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                        fs1, fs2, self.BitIn, self.BitOut, self.BitW, self.BitActivation,
+                        db, self.dma_parallelization)
+                    if best_cycles is None or cycles < best_cycles:
+                        best_cycles = cycles
+                        best_tiling = (tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out)
+        return best_tiling
+
+    @cached_tiling
     def get_tiling_conv2d_like(self,
                                DW,
                                filter_size1,
@@ -1085,7 +1300,8 @@ class Tiling():
                                buffer_size,
                                full_computation=True,
                                multiple_buffering_factor=2,
-                               name='conv'): 
+                               name='conv',
+                               exit_on_failure=True): 
         # This function is used to create the tiling parameters for a conv2d like operation.
         ## initial parameters
         fs1 = filter_size1
@@ -1140,6 +1356,16 @@ class Tiling():
             return (n_in, n_out, h_in, h_out, w_in, w_out)
         else:
             db = multiple_buffering_factor
+        # small search spaces are solved by enumeration, the CP model is the fallback
+        start = time.time()
+        tiling = self.get_tiling_conv2d_like_enumerative(DW, fs1, fs2, s, (padding_top, padding_bottom, padding_left, padding_right), BN,
+                                                         n_in, n_out, h_in, w_in, h_out, w_out, db, name)
+        if tiling is not None:
+            TILER_STATISTICS['enumeration'][0] += 1
+            TILER_STATISTICS['enumeration'][1] += time.time() - start
+            if not self.cp_baseline:
+                return tiling
+        start = time.time()
         # searching for tiling parameters
         for iteration in range(0, 4):
             parameters = pywrapcp.Solver.DefaultSolverParameters()
@@ -1156,14 +1382,9 @@ class Tiling():
             tile_w_out = solver.IntVar(min_tile_w_out, w_out, 'tile_w_out')
             zero_variable = solver.IntVar(0, 0, 'zero_variable')
 
-            # scaling is used to ensure datasize is integer
-            ds_x_scale = int(math.floor(32 * self.BitIn))
-            ds_y_scale = int(math.floor(32 * self.BitOut))
-            ds_W_scale = int(math.floor(32 * self.BitW))
-            ds_bn_scale = int(math.floor(32 * self.BitActivation))
             if DW != 1 or (h_in > 32 and w_in > 32):
                 solver.Add(0 == (tile_h_in - fs1) % s)
-                #solver.Add(0 == (tile_w_in - fs2) % s)
+                solver.Add(0 == (tile_w_in - fs2) % s)
             if DW == 1:
                 solver.Add(tile_n_in == tile_n_out)
             if DW == 1:
@@ -1173,35 +1394,21 @@ class Tiling():
                     solver.Add(tile_h_out == h_out)
                     solver.Add(tile_w_out == w_out)
                 elif h_in > 32 or w_in > 32:
+                    # tiles along h and w overlap by the filter halo: padding is only added to full-size tiles.
+                    # Width tiling with halo and border padding is enabled only here, for depthwise layers larger
+                    # than 32x32: smaller depthwise layers are never tiled spatially, and DW == 0 layers tile w
+                    # with the padding only in the full width tile (see the solution postprocessing below).
                     solver.Add(tile_h_out * s == (tile_h_in - (fs1 - 1) + ((tile_h_in % h_in) == 0) * (padding_top + padding_bottom) + (s - 1)))
-                    #solver.Add(tile_w_out * s == (tile_w_in - (fs2 - 1) + ((tile_w_in % w_in) == 0) * (padding_left + padding_right) + (s - 1)))
-                    solver.Add(tile_w_in == w_in)
-                    solver.Add(tile_w_out == w_out)
+                    solver.Add(tile_w_out * s == (tile_w_in - (fs2 - 1) + ((tile_w_in % w_in) == 0) * (padding_left + padding_right) + (s - 1)))
             elif DW == 0:
                 solver.Add(tile_h_out * s ==(tile_h_in - (fs1 - 1) + (s - 1)))
                 solver.Add(tile_w_out * s ==(tile_w_in - (fs2 - 1) + (s - 1)))
             # constraints of border tile. It can't be smaller than filter size
             solver.Add(solver.Max((h_in - tile_h_in - (tile_h_in - fs1 + 1 - padding_top)), 0) % (tile_h_in - fs1 + 1) + abs(solver.Min(solver.Max((h_in - tile_h_in - (tile_h_in - fs1 + 1 - padding_bottom)), 0) % (tile_h_in - fs1 + 1), 1) - 1) * fs1 >= fs1)
             solver.Add(solver.Max((w_in - tile_w_in - (tile_w_in - fs2 + 1 - padding_left)), 0) % (tile_w_in - fs2 + 1) + abs(solver.Min(solver.Max((w_in - tile_w_in - (tile_w_in - fs2 + 1 - padding_right)), 0) % (tile_w_in - fs2 + 1), 1) - 1) * fs2 >= fs2)
-            constr_in = db * ds_x_scale * tile_n_in * tile_h_in * tile_w_in
-            constr_out = db * ds_y_scale * tile_n_out * tile_h_out * tile_w_out
-            if DW == 0:
-                constr_weight = db * ds_W_scale * tile_n_in * tile_n_out * fs1 * fs2
-                constr_im2col = 32 * 8 * 2 * 8 * fs1 * fs2 * tile_n_in
-            else:
-                constr_weight = db * ds_W_scale * tile_n_in * fs1 * fs2
-                constr_im2col = 32 * 8 * 8 * ( fs1 * (tile_h_in + padding_top + padding_bottom) + fs1) * int( 8 / min(self.BitIn, self.BitOut, self.BitW))
-                constr_weight_full_prec = db * 32 * 8 * 8 * fs1 * fs2 * int( 8 / min(self.BitIn, self.BitOut, self.BitW))
-                if self.BitW==8:
-                    constr_weight_full_prec = 0
-            if 'MatMul' in name or 'Gemm' in name:
-                constr_im2col = 0
-            constr_bn = ds_bn_scale * tile_n_out * 2 * db
-            constraint_all = constr_in + constr_out + constr_weight + constr_bn + constr_im2col + 20 
-            if DW == 1:
-                constraint_all += constr_weight_full_prec
-            if BN == 0:
-                constraint_all -= constr_bn
+            constraint_all = self.conv2d_l1_occupation(DW, BN, fs1, fs2, padding_top, padding_bottom, n_out,
+                                                       tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out,
+                                                       db, name)
             solver.Add(constraint_all <= 32 * self.buffer_size * 8)
             if DW == 0:
                 solver.Add(tile_n_in == n_in)
@@ -1209,34 +1416,45 @@ class Tiling():
             if DW == 1: 
                 solver.Add(tile_n_in % (int(8/min(self.BitIn, self.BitOut, self.BitW)))==0)
             solver.Add(tile_n_out % (int(8/min(self.BitIn, self.BitOut, self.BitW)))==0)
-            obj_expr = solver.IntVar(0, max_obj_value, "obj_expr")
-            ## added some constraints for border tiles:     
-            # 1. TILE_N_OUT / 4 LOWER IMPORTANCE THAN W / 2 and H / 8
-            # 2. same constraints imposed for border tiles
-            if DW == 0:
-                solver.Add(obj_expr == (64 * 10000 * tile_n_out
-                                        + constraint_all
-                                        + 64 * 2000000 * ((tile_h_out - 1) % 8)
-                                        + 64 * 3000000 * ((tile_w_out - 1) % 2)
-                                        + 64 * 1000000 * ((tile_n_out - 1) % 4) 
-                                        + 64 * 1000000 * (tile_w_out * tile_h_out >= 16)
-                                        + 64 * 10000 * ((n_out-zero_variable) % (tile_n_out+1))
-                                        + 64 * 10000 * (((n_out-zero_variable) % (tile_n_out+1)) % 4)
-                                        + 64 * 20000 * (((h_out-zero_variable) % (tile_h_out+1)) % 8)
-                                        + 64 * 30000 * (((w_out-zero_variable) % (tile_w_out+1)) % 2) ))
+            if self.cost_model is not None:
+                # objective function: predicted cycles of the whole layer, see cost_model.py
+                family = self.cost_model.kernel_family(name, DW, fs1, fs2, s)
+                obj_expr = self.cost_model.conv_layer_cycles(family, DW, BN,
+                                                             n_in, n_out, h_in, h_out, w_out,
+                                                             tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                                                             fs1, fs2, self.BitIn, self.BitOut, self.BitW, self.BitActivation,
+                                                             multiple_buffering_factor, self.dma_parallelization, solver).Var()
+                objective = solver.Minimize(obj_expr, 1)
             else:
-                solver.Add(obj_expr == (constraint_all
-                                        + 32 * 1000 * tile_w_out
-                                        + 32 * 1000 * tile_h_out
-                                        + 32 * 10000 * ((tile_n_out > 7))
-                                        + 64 * 10000 * ((tile_n_out - 1) % int(8*8/min(self.BitIn, self.BitOut, self.BitW)))
-                                        + 32 * 10000 * ((tile_h_out % 4) == 0)
-                                        + 32 * 100 * (((n_out-zero_variable) % (tile_n_out+1)) > 7)
-                                        + 32 * 100 * (((h_out-zero_variable) % (tile_h_out+1)))
-                                        + 32 * 100 * (((h_out-zero_variable) % (tile_h_out+1)) % 4)
-                                        + 32 * 100 * (((w_out-zero_variable) % (tile_w_out+1)))))
-
-            objective = solver.Maximize(obj_expr, 1)
+                obj_expr = solver.IntVar(0, max_obj_value, "obj_expr")
+                ## added some constraints for border tiles:     
+                # 1. TILE_N_OUT / 4 LOWER IMPORTANCE THAN W / 2 and H / 8
+                # 2. same constraints imposed for border tiles
+                if DW == 0:
+                    solver.Add(obj_expr == (64 * 10000 * tile_n_out
+                                            + constraint_all
+                                            + 64 * 2000000 * ((tile_h_out - 1) % 8)
+                                            + 64 * 3000000 * ((tile_w_out - 1) % 2)
+                                            + 64 * 1000000 * ((tile_n_out - 1) % 4) 
+                                            + 64 * 1000000 * (tile_w_out * tile_h_out >= 16)
+                                            + 64 * 10000 * ((n_out-zero_variable) % (tile_n_out+1))
+                                            + 64 * 10000 * (((n_out-zero_variable) % (tile_n_out+1)) % 4)
+                                            + 64 * 20000 * (((h_out-zero_variable) % (tile_h_out+1)) % 8)
+                                            + 64 * 30000 * (((w_out-zero_variable) % (tile_w_out+1)) % 2) ))
+                else:
+                    solver.Add(obj_expr == (constraint_all
+                                            + 32 * 1000 * tile_w_out
+                                            + 32 * 1000 * tile_h_out
+                                            + 32 * 1000 * solver.Min(tile_w_out, tile_h_out)
+                                            + 32 * 10000 * ((tile_n_out > 7))
+                                            + 64 * 10000 * ((tile_n_out - 1) % int(8*8/min(self.BitIn, self.BitOut, self.BitW)))
+                                            + 32 * 10000 * ((tile_h_out % 4) == 0)
+                                            + 32 * 100 * (((n_out-zero_variable) % (tile_n_out+1)) > 7)
+                                            + 32 * 100 * (((h_out-zero_variable) % (tile_h_out+1)))
+                                            + 32 * 100 * (((h_out-zero_variable) % (tile_h_out+1)) % 4)
+                                            + 32 * 100 * (((w_out-zero_variable) % (tile_w_out+1)))))
+
+                objective = solver.Maximize(obj_expr, 1)
 
             decision_builder = solver.Phase([tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out],
                                             solver.CHOOSE_FIRST_UNBOUND,
@@ -1253,6 +1471,12 @@ class Tiling():
             # Add the objective.
             collector.AddObjective(obj_expr)
             solver.Solve(decision_builder, [objective, collector])
+        # the enumerated tiling is kept: the CP model only ran as baseline
+        statistics = 'CP' if tiling is None else 'CP baseline'
+        TILER_STATISTICS[statistics][0] += 1
+        TILER_STATISTICS[statistics][1] += time.time() - start
+        if tiling is not None:
+            return tiling
         if collector.SolutionCount() > 0:
             best_solution = collector.SolutionCount() - 1
             tile_n_in = collector.Value(best_solution, tile_n_in)
@@ -1268,10 +1492,121 @@ class Tiling():
                 tile_w_in = w_in
                 tile_w_out = int((tile_w_in -(fs2 - 1) + (padding_left + padding_right) + (s - 1))/s)
             return (tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out)
+        if not exit_on_failure:
+            return None
         print("  Conv2d ERROR: no L2-L1 tiling found. Exiting...")
         os._exit(0)
         return None
 
+    def inplace_output_offset(self, n_in, n_out, h_in, w_in, h_out, w_out, tile_n_in, tile_n_out, tile_h_out, tile_w_out, s, p_top):
+        # Smallest distance of the L2 output after the L2 input such that the output tiles never overwrite input still to be read.
+        # A single tile reads the whole input before writing. Otherwise the tiles are visited by rows and each input
+        # row is read by one row of tiles only if the tiles span all the channels and the whole width:
+        # when the first k output rows are written, the first input row still to be read is k*s - p_top.
+        if tile_n_in >= n_in and tile_n_out >= n_out and tile_h_out >= h_out and tile_w_out >= w_out:
+            return 0
+        if tile_n_in < n_in or tile_n_out < n_out or tile_w_out < w_out:
+            return None
+        row_in = int(n_in * w_in * self.BitIn / 8)
+        row_out = int(n_out * w_out * self.BitOut / 8)
+        offset = 0
+        for k in range(tile_h_out, h_out, tile_h_out):
+            offset = max(offset, k * row_out - max(k * s - p_top, 0) * row_in)
+        return offset
+
+    def tile_sizes(self, dim, multiple=1):
+        # smallest tile size, multiple of multiple, giving each possible number of tiles along a dimension of size dim:
+        # any other size uses more memory and more cycles for the same number of tiles.
+        sizes = []
+        for n_tiles in range(1, dim + 1):
+            size = int(math.ceil(math.ceil(dim / n_tiles) / multiple)) * multiple
+            if size <= dim and size not in sizes:
+                sizes.append(size)
+        return sizes
+
+    def border_tile_fits(self, dim_in, tile_in, fs, padding_a, padding_b):
+        # same constraint on the border tiles imposed in get_tiling_conv2d_like: they can't be smaller than the filter
+        step = tile_in - fs + 1
+        if tile_in >= dim_in or step <= 0:
+            return True
+        return (max(dim_in - tile_in - (step - padding_a), 0) % step
+                + abs(min(max(dim_in - tile_in - (step - padding_b), 0) % step, 1) - 1) * fs >= fs)
+
+    def tile_pairs(self, dim_in, dim_out, fs, s, padding_a, padding_b):
+        # (tile_in, tile_out) along h or w for the sizes of tile_sizes, with the halo of the filter between the input tiles
+        pairs = []
+        for tile_out in self.tile_sizes(dim_out):
+            tile_in = dim_in if tile_out == dim_out else (tile_out - 1) * s + fs
+            if tile_out < dim_out and tile_in >= dim_in:
+                continue
+            if self.border_tile_fits(dim_in, tile_in, fs, padding_a, padding_b):
+                pairs.append((tile_in, tile_out))
+        return pairs
+
+    def explore_conv2d_like(self, DW, fs1, fs2, s, padding, BN, n_in, n_out, h_in, w_in, h_out, w_out, name, selected):
+        # Enumerates the L2-L1 tilings of a conv2d like layer, regardless of the L1 budget, and returns the ones
+        # not dominated in (L1 bytes, DMA commands, predicted cycles), with the same constraints of the CP tiler.
+        # The L2 occupation of the layer (whole input, output and weights) does not depend on its L2-L1 tiling.
+        # Only tile sizes giving a distinct number of tiles along each dimension are visited.
+        # selected = (tiling, multiple_buffering_factor) of the tiler is always returned, flagged, even if dominated.
+        padding_top, padding_bottom, padding_left, padding_right = padding
+        multiple = int(8 / min(self.BitIn, self.BitOut, self.BitW))
+        family = self.cost_model.kernel_family(name, DW, fs1, fs2, s)
+
+        def evaluate(tiling, n_buffers):
+            tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out = tiling
+            n_tiles = int(math.ceil(n_out / tile_n_out) * math.ceil(h_out / tile_h_out) * math.ceil(w_out / tile_w_out))
+            db = 1 if n_tiles == 1 else n_buffers
+            L1_bytes = int(math.ceil(self.conv2d_l1_occupation(DW, BN, fs1, fs2, padding_top, padding_bottom, n_out,
+                                                                tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out,
+                                                                db, name) / 256.))
+            commands = self.cost_model.conv_layer_dma_commands(DW, BN, n_in, n_out, h_out, w_out,
+                                                               tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_out)
+            cycles = self.cost_model.to_cycles(self.cost_model.conv_layer_cycles(family, DW, BN,
+                n_in, n_out, h_in, h_out, w_out,
+                tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                fs1, fs2, self.BitIn, self.BitOut, self.BitW, self.BitActivation,
+                n_buffers, self.dma_parallelization))
+            return {'tile_n_in': tile_n_in, 'tile_n_out': tile_n_out,
+                    'tile_h_in': tile_h_in, 'tile_h_out': tile_h_out,
+                    'tile_w_in': tile_w_in, 'tile_w_out': tile_w_out,
+                    'n_buffers': n_buffers, 'n_tiles': n_tiles, 'L1_bytes': L1_bytes,
+                    'DMA_commands': commands, 'predicted_cycles': cycles, 'pareto': 0, 'selected': 0}
+
+        if DW == 1 and h_in <= 32 and w_in <= 32:
+            h_pairs = [(h_in, h_out)]
+            w_pairs = [(w_in, w_out)]
+        else:
+            h_pairs = self.tile_pairs(h_in, h_out, fs1, s, padding_top, padding_bottom)
+            w_pairs = self.tile_pairs(w_in, w_out, fs2, s, padding_left, padding_right)
+        points = []
+        for tile_n_out in self.tile_sizes(n_out, multiple):
+            tile_n_in = tile_n_out if DW == 1 else n_in
+            for tile_h_in, tile_h_out in h_pairs:
+                for tile_w_in, tile_w_out in w_pairs:
+                    for n_buffers in self.multiple_buffering_candidates(DW, 2):
+                        point = evaluate((tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out), n_buffers)
+                        if n_buffers > 2 and point['n_tiles'] < n_buffers:
+                            continue
+                        points.append(point)
+        # sorted by L1 bytes, a point is kept only if no point before it is at least as good on all the other metrics
+        points.sort(key=lambda point: (point['L1_bytes'], point['predicted_cycles'], point['DMA_commands']))
+        front = []
+        for point in points:
+            if not any(other['DMA_commands'] <= point['DMA_commands'] and other['predicted_cycles'] <= point['predicted_cycles']
+                       for other in front):
+                point['pareto'] = 1
+                front.append(point)
+        selected_point = evaluate(*selected)
+        for point in front:
+            if all(point[key] == selected_point[key] for key in ['tile_n_in', 'tile_n_out', 'tile_h_in', 'tile_h_out', 'tile_w_in', 'tile_w_out', 'n_buffers']):
+                point['selected'] = 1
+                break
+        else:
+            selected_point['selected'] = 1
+            front.append(selected_point)
+        return front
+
     def get_tiling_conv2d(self, X, Y, W,
                           relu,
                           BN,
@@ -1319,6 +1654,7 @@ class Tiling():
         # number of L3 tiles identification and dimension for L2 tiles.
         n_in, n_out, h_in, h_out, w_in, w_out = tiling
         factor_ch_out = self.out_ch/n_out
+        L3_loop_order = 'activations'
         factor_h_out = (int(np.floor((self.x_shape[-2] - (fs1 - 1) + p_top + p_bottom + (s - 1)) / s)))/h_out
         conv_overlap_h = 2 * (fs1 // 2) + fs1 % 2 - 1 - (s - 1)
         if (self.x_shape[-2] - h_in)==0:
@@ -1399,9 +1735,19 @@ class Tiling():
             if int(W_no_str) > 1:
                 logging.debug("    Tiling Weights")
             if int(W_no_str) > 1 and (factor_h_in > 1 or factor_h_out > 1):
-                print("Convolution: Tiling of weights and Input/output activation from L3 not yet working. Exiting...")
-                print(f"Input Constraint: {input_dim_constraint}, Output+Weights Constraint: {output_weights_dim_constraint}, Weight constraint: {weight_constraint}")
-                os._exit(0)
+                if g > 1:
+                    weights_L3 = ds_W * ch_out_L3 * fs1 * fs2 / 8.
+                else:
+                    weights_L3 = ds_W * ch_out_L3 * n_in * fs1 * fs2 / 8.
+                if BN == 1:
+                    weights_L3 += ch_out_L3 * 2 * self.BitActivation / 8.
+                L3_loop_order, traffic = self.get_L3_loop_order(
+                    int(W_no_str), factor_h_in, int(factor_h_out), input_L3,
+                    ds_x * g * n_in * h_in_L3 * w_in / 8.,
+                    ds_y * ch_out_L3 * h_out_L3 * w_out / 8.,
+                    weights_L3)
+                logging.debug("    L3 loop order:".ljust(18) + (L3_loop_order + " outer").ljust(15) +
+                              "HyperRAM traffic: activations outer %d B, weights outer %d B" % (traffic['activations'], traffic['weights']))
         else:
             if g > 1:
                 logging.debug("  Conv2d Depthwise tiling:")
@@ -1414,29 +1760,22 @@ class Tiling():
         if factor_h_out > 1:
             h_in = h_out * s + (fs1 - 1) - (s - 1)
         if (p_top + p_bottom) > 0 and (factor_h_in > 1 or factor_h_out > 1):
-            tiling = self.get_tiling_conv2d_like(
-                DW,
-                fs1,
-                fs2,
-                s,
-                0, 0, p_left, p_right,
-                g,
-                BN,
-                n_in,
-                n_out,
-                [n_in, h_in, w_in],
-                [n_out, h_out, w_out],
-                self.buffer_size,
-                full_computation=full_computation,
-                multiple_buffering_factor=multiple_buffering_factor,
-                name=name)
+            padding_L1 = (0, 0, p_left, p_right)
         else:
-            tiling = self.get_tiling_conv2d_like(
+            padding_L1 = (p_top, p_bottom, p_left, p_right)
+        # the depth of the L1 buffer ring is chosen together with the tiling
+        candidates = self.multiple_buffering_candidates(DW, multiple_buffering_factor)
+        tiling = None
+        best_cycles = None
+        for n_buffers in candidates:
+            # only the first candidate is guaranteed to fit: deeper rings may have no solution
+            extra_arguments = {} if n_buffers == candidates[0] else {'exit_on_failure': False}
+            tiling_n = self.get_tiling_conv2d_like(
                 DW,
                 fs1,
                 fs2,
                 s,
-                p_top,p_bottom,p_left,p_right,
+                padding_L1[0], padding_L1[1], padding_L1[2], padding_L1[3],
                 g,
                 BN,
                 n_in,
@@ -1445,13 +1784,41 @@ class Tiling():
                 [n_out, h_out, w_out],
                 self.buffer_size,
                 full_computation=full_computation,
-                multiple_buffering_factor=multiple_buffering_factor,
-                name=name)        
+                multiple_buffering_factor=n_buffers,
+                name=name,
+                **extra_arguments)
+            if len(candidates) == 1:
+                tiling = tiling_n
+                break
+            if tiling_n is None:
+                continue
+            tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out = tiling_n
+            n_tiles = math.ceil(n_out / tile_n_out) * math.ceil(h_out / tile_h_out) * math.ceil(w_out / tile_w_out)
+            if n_buffers > 2 and n_tiles < n_buffers:
+                continue
+            family = self.cost_model.kernel_family(name, DW, fs1, fs2, s)
+            cycles = self.cost_model.conv_layer_cycles(family, DW, BN,
+                n_in * g, n_out, h_in, h_out, w_out,
+                tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                fs1, fs2, ds_x, ds_y, ds_W, self.BitActivation,
+                n_buffers, self.dma_parallelization)
+            if best_cycles is None or cycles < best_cycles:
+                best_cycles = cycles
+                tiling = tiling_n
+                multiple_buffering_factor = n_buffers
         name_include.append(name)
+        if self.exploration is not None and tiling is not None:
+            self.exploration.add_layer(name, self.explore_conv2d_like(DW, fs1, fs2, s, padding_L1, BN,
+                                                                      n_in * g, n_out, h_in, w_in, h_out, w_out, name,
+                                                                      (tiling, multiple_buffering_factor)))
         # report
         if tiling is not None:
 
             tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out = tiling
+            # stride-1 pointwise layers can write their output over their input
+            if L3_tiling == 0 and DW == 0 and fs1 == 1 and fs2 == 1 and s == 1 and 'Gemm' not in name and 'MatMul' not in name:
+                self.inplace_offset = self.inplace_output_offset(n_in, n_out, h_in, w_in, h_out, w_out,
+                                                                 tile_n_in, tile_n_out, tile_h_out, tile_w_out, s, p_top)
 
             x_tot_str = '[%dx%dx%d]' % (g * n_in, h_in, w_in)
             y_tot_str = '[%dx%dx%d]' % (n_out, h_out, w_out)
@@ -1511,6 +1878,16 @@ class Tiling():
             logging.debug("    no. tiles:".ljust(18) + "x: " + x_no_str.ljust(15) +
                           "y: " + y_no_str.ljust(15) + "W: " + W_no_str.ljust(15))
             logging.debug("    Total L1 occupation:".ljust(18) + str(L1_tiles_size * 1.).ljust(15))
+            if multiple_buffering_factor > 2:
+                logging.debug("    L1 buffering:".ljust(18) + '%d-deep ring' % multiple_buffering_factor)
+            if self.cost_model is not None:
+                family = self.cost_model.kernel_family(name, DW, fs1, fs2, s)
+                predicted_cycles = self.cost_model.to_cycles(self.cost_model.conv_layer_cycles(family, DW, BN,
+                    n_in * g, n_out, h_in, h_out, w_out,
+                    tile_n_in, tile_n_out, tile_h_in, tile_w_in, tile_h_out, tile_w_out,
+                    fs1, fs2, ds_x, ds_y, ds_W, self.BitActivation,
+                    multiple_buffering_factor, self.dma_parallelization))
+                logging.debug("    Predicted cycles:".ljust(18) + str(predicted_cycles).ljust(15) + "(" + family + " kernel)")
             # printing layer .c file. Either a unique one, or top,bottom and middle one (for which also tiling is computed).
             if (p_top+p_bottom) > 0 and (factor_h_in > 1 or factor_h_out > 1):
                 in_dim1, out_dim1, weight_dim1, l2_dim_k, l2_dim_lambda, bias_dim1, l1_dim1, n_out1, w_out1, h_out1 = print_template_layer(
@@ -1535,7 +1912,12 @@ class Tiling():
                     optional_type=self.optional_type,
                     L3_tiling = L3_tiling,
                     sdk = self.sdk,
-                    dma_parallelization = self.dma_parallelization)
+                    dma_parallelization = self.dma_parallelization,
+                    multiple_buffering_factor = multiple_buffering_factor,
+                    BN_whole = self.bn_whole_layer(DW, BN, fs1, fs2, 0, 0, n_out, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name),
+                    hwc_to_chw_L1 = self.hwc_to_chw_layer(DW, BN, fs1, fs2, s, 0, 0, n_in * g, n_out, h_in, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name))
             else:
                 in_dim1, out_dim1, weight_dim1, l2_dim_k, l2_dim_lambda, bias_dim1, l1_dim1, n_out1, w_out1, h_out1 = print_template_layer(
                     X, Y, W,
@@ -1559,7 +1941,12 @@ class Tiling():
                     optional_type=self.optional_type,
                     L3_tiling = L3_tiling,
                     sdk = self.sdk,
-                    dma_parallelization = self.dma_parallelization)   
+                    dma_parallelization = self.dma_parallelization,
+                    multiple_buffering_factor = multiple_buffering_factor,
+                    BN_whole = self.bn_whole_layer(DW, BN, fs1, fs2, p_top, p_bottom, n_out, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name),
+                    hwc_to_chw_L1 = self.hwc_to_chw_layer(DW, BN, fs1, fs2, s, p_top, p_bottom, n_in * g, n_out, h_in, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name))
             if (p_top + p_bottom) > 0 and (factor_h_in > 1 or factor_h_out > 1):
                 tiling = self.get_tiling_conv2d_like(
                     DW,
@@ -1600,7 +1987,12 @@ class Tiling():
                     optional_type=self.optional_type,
                     L3_tiling = L3_tiling,
                     sdk = self.sdk,
-                    dma_parallelization = self.dma_parallelization)      
+                    dma_parallelization = self.dma_parallelization,
+                    multiple_buffering_factor = multiple_buffering_factor,
+                    BN_whole = self.bn_whole_layer(DW, BN, fs1, fs2, p_top, 0, n_out, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name),
+                    hwc_to_chw_L1 = self.hwc_to_chw_layer(DW, BN, fs1, fs2, s, p_top, 0, n_in * g, n_out, h_in, h_out, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name))
                 h_in_last = h_in
                 h_out_last = int(np.floor((h_in_last + p_bottom - (fs1 - 1) + (s - 1)) / s))
                 #### CHECK WELL especially second nested if
@@ -1659,7 +2051,12 @@ class Tiling():
                     optional_type=self.optional_type,
                     L3_tiling = L3_tiling,
                     sdk = self.sdk,
-                    dma_parallelization = self.dma_parallelization)
+                    dma_parallelization = self.dma_parallelization,
+                    multiple_buffering_factor = multiple_buffering_factor,
+                    BN_whole = self.bn_whole_layer(DW, BN, fs1, fs2, 0, p_bottom, n_out, h_out_last, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name),
+                    hwc_to_chw_L1 = self.hwc_to_chw_layer(DW, BN, fs1, fs2, s, 0, p_bottom, n_in * g, n_out, h_in_last, h_out_last, w_out,
+                        tile_n_in, tile_n_out, tile_h_in, tile_h_out, tile_w_in, tile_w_out, multiple_buffering_factor, name))
                 name_include.append(name + '_p_t')
                 name_include.append(name + '_p_b')                   
             if self.test_location == 'L3_partial':
@@ -1693,10 +2090,13 @@ class Tiling():
                     self.test_location,
                     out_mul, out_shift,
                     self.buffer_size,
-                    input_L3)
+                    input_L3,
+                    L3_loop_order,
+                    bias_dim1)
             ### L2 memory calculation
             if factor_h_out > 1:
-                out_dim1 = out_dim1*2
+                # output tiles hold all the output channels, also when weights are tiled
+                out_dim1 = out_dim1*int(factor_ch_out)*2
             else:
                 n_out_temp = self.out_ch
                 h_in_temp = self.x_shape[-2]
@@ -1725,6 +2125,167 @@ class Tiling():
             return in_dim1, out_dim1, weights_dim, l1_dim1, L3_tiling, factor_ch_out, factor_h_out, factor_h_in
         return None
 
+    def fused_dw_pw_l1_occupation(self, n_out, BN, tile_h_in, tile_h_out):
+        # bytes of L1 used by layer_template_fused.c. Input and output tiles are double buffered,
+        # the depthwise output is a single buffer consumed by the pointwise kernel of the same tile.
+        n_in = self.x_shape[0]
+        h_in = self.x_shape[-2]
+        w_in = self.x_shape[-1]
+        fs1 = self.filter_size[0]
+        fs2 = self.filter_size[1]
+        s = self.stride
+        h_out = int(np.floor((h_in - (fs1 - 1) + self.padding[0] + self.padding[2] + (s - 1)) / s))
+        w_out = int(np.floor((w_in - (fs2 - 1) + self.padding[1] + self.padding[3] + (s - 1)) / s))
+        db = 2 if tile_h_out < h_out else 1
+        x_buffer = db * int(math.ceil(self.BitIn * n_in * tile_h_in * w_in / 8.0))
+        dw_buffer = n_in * tile_h_out * w_out
+        y_buffer = db * int(math.ceil(self.BitOut * n_out * tile_h_out * w_out / 8.0))
+        W_buffer = int(math.ceil(self.BitW * (n_in * fs1 * fs2 + n_in * n_out) / 8.0))
+        bn_buffer = BN * int(self.BitActivation / 8) * 2 * (n_in + n_out)
+        im2col_buffer = 8 * (fs1 * (tile_h_in + 2 * self.padding[0]) + fs1)
+        # 4 bytes of alignment after each of the 9 buffers
+        return x_buffer + dw_buffer + y_buffer + W_buffer + bn_buffer + im2col_buffer + 40
+
+    def get_tiling_fused_dw_pw_like(self, n_out, BN):
+        # Common row tile of a depthwise layer (the one of this Tiling object) and of the 1x1 pointwise layer
+        # with n_out output channels that follows it. All the channels and the whole width are kept in L1, so the
+        # search is over the output rows only: the tiles are enumerated instead of using the CP solver.
+        # Consecutive input tiles overlap by fs1 - stride rows (the halo of the depthwise).
+        # Returns (tile_h_in, tile_h_out, predicted cycles) minimizing the cost model, or None.
+        n_in = self.x_shape[0]
+        h_in = self.x_shape[-2]
+        w_in = self.x_shape[-1]
+        fs1 = self.filter_size[0]
+        fs2 = self.filter_size[1]
+        s = self.stride
+        h_out = int(np.floor((h_in - (fs1 - 1) + self.padding[0] + self.padding[2] + (s - 1)) / s))
+        w_out = int(np.floor((w_in - (fs2 - 1) + self.padding[1] + self.padding[3] + (s - 1)) / s))
+        best = None
+        for tile_h_out in range(h_out, 0, -1):
+            if tile_h_out == h_out:
+                tile_h_in = h_in
+            else:
+                tile_h_in = tile_h_out * s + fs1 - s
+                if tile_h_in - (fs1 - s) <= 0 or tile_h_in > h_in:
+                    continue
+            if self.fused_dw_pw_l1_occupation(n_out, BN, tile_h_in, tile_h_out) > self.buffer_size:
+                continue
+            if self.cost_model is None:
+                # biggest tile that fits
+                return (tile_h_in, tile_h_out, 0)
+            cycles = self.cost_model.to_cycles(self.cost_model.fused_dw_pw_cycles(
+                n_in, n_out, h_in, h_out, w_out,
+                tile_h_in, w_in, tile_h_out,
+                fs1, fs2, self.BitIn, self.BitOut, self.BitW, self.BitActivation,
+                self.dma_parallelization))
+            if best is None or cycles < best[2]:
+                best = (tile_h_in, tile_h_out, cycles)
+        return best
+
+    def get_tiling_unfused_dw_pw_like(self, n_out, BN):
+        # Cost of the same two layers executed one after the other, each one with its best row tile over
+        # all the channels and the intermediate activation going back and forth to L2. Used to decide the fusion.
+        n_in = self.x_shape[0]
+        h_in = self.x_shape[-2]
+        w_in = self.x_shape[-1]
+        fs1 = self.filter_size[0]
+        fs2 = self.filter_size[1]
+        s = self.stride
+        h_out = int(np.floor((h_in - (fs1 - 1) + self.padding[0] + self.padding[2] + (s - 1)) / s))
+        w_out = int(np.floor((w_in - (fs2 - 1) + self.padding[1] + self.padding[3] + (s - 1)) / s))
+        bn_dim = BN * int(self.BitActivation / 8) * 2
+        best_dw = None
+        best_pw = None
+        for tile_h_out in range(h_out, 0, -1):
+            db = 2 if tile_h_out < h_out else 1
+            tile_h_in = h_in if tile_h_out == h_out else tile_h_out * s + fs1 - s
+            if tile_h_in > h_in:
+                continue
+            # depthwise
+            occupation = (db * int(math.ceil(self.BitIn * n_in * tile_h_in * w_in / 8.0)) + db * n_in * tile_h_out * w_out
+                          + db * n_in * fs1 * fs2 + bn_dim * n_in + 8 * (fs1 * (tile_h_in + 2 * self.padding[0]) + fs1))
+            if occupation <= self.buffer_size:
+                cycles = self.cost_model.to_cycles(self.cost_model.conv_layer_cycles('depthwise', 1, BN,
+                    n_in, n_in, h_in, h_out, w_out,
+                    n_in, n_in, tile_h_in, w_in, tile_h_out, w_out,
+                    fs1, fs2, self.BitIn, 8, self.BitW, self.BitActivation,
+                    2, self.dma_parallelization))
+                if best_dw is None or cycles < best_dw:
+                    best_dw = cycles
+            # pointwise
+            occupation = (db * n_in * tile_h_out * w_out + db * int(math.ceil(self.BitOut * n_out * tile_h_out * w_out / 8.0))
+                          + int(math.ceil(self.BitW * n_in * n_out / 8.0)) + bn_dim * n_out)
+            if occupation <= self.buffer_size:
+                cycles = self.cost_model.to_cycles(self.cost_model.conv_layer_cycles('pointwise', 0, BN,
+                    n_in, n_out, h_out, h_out, w_out,
+                    n_in, n_out, tile_h_out, w_out, tile_h_out, w_out,
+                    1, 1, 8, self.BitOut, self.BitW, self.BitActivation,
+                    2, self.dma_parallelization))
+                if best_pw is None or cycles < best_pw:
+                    best_pw = cycles
+        if best_dw is None or best_pw is None:
+            return None
+        return best_dw + best_pw
+
+    def get_tiling_fused(self, X, Y, W,
+                         relu,
+                         BN,
+                         pw_out_ch,
+                         out_mul, out_shift,
+                         pw_out_mul, pw_out_shift,
+                         type_data='char',
+                         name='fused'
+                         ):
+        # Depthwise + pointwise layer executed depth-first: each row tile of the input goes through both kernels
+        # in L1 and only the output of the pointwise is written back to L2.
+        # Only L2 resident activations and weights are supported: L3 tiling is never used for a fused layer.
+        ds_x = self.BitIn
+        ds_y = self.BitOut
+        ds_W = self.BitW
+        fs1 = self.filter_size[0]
+        fs2 = self.filter_size[1]
+        s = self.stride
+        n_in = self.x_shape[0]
+        n_out = pw_out_ch
+        h_in = self.x_shape[-2]
+        w_in = self.x_shape[-1]
+        h_out = int(np.floor((h_in - (fs1 - 1) + self.padding[0] + self.padding[2] + (s - 1)) / s))
+        w_out = int(np.floor((w_in - (fs2 - 1) + self.padding[1] + self.padding[3] + (s - 1)) / s))
+        tiling = self.get_tiling_fused_dw_pw_like(n_out, BN)
+        if tiling is None:
+            print("  Fused layer: the depthwise and pointwise layers do not fit L1 with any row tile. Exiting...")
+            os._exit(0)
+        tile_h_in, tile_h_out, predicted_cycles = tiling
+        x_tot_str = '[%dx%dx%d]' % (n_in, h_in, w_in)
+        y_tot_str = '[%dx%dx%d]' % (n_out, h_out, w_out)
+        W_tot_str = '[%dx1x%dx%d]+[%dx%d]' % (n_in, fs1, fs2, n_out, n_in)
+        x_tile_str = '[%dx%dx%d]' % (n_in, tile_h_in, w_in)
+        y_tile_str = '[%dx%dx%d]' % (n_out, tile_h_out, w_out)
+        dw_tile_str = '[%dx%dx%d]' % (n_in, tile_h_out, w_out)
+        logging.debug("    fused:".ljust(18) + "depthwise %dx%d + pointwise" % (fs1, fs2))
+        logging.debug("    L2 size:".ljust(18) + "x: " + x_tot_str.ljust(15) +
+                      "y: " + y_tot_str.ljust(15) + "W: " + W_tot_str.ljust(15))
+        logging.debug("    tiles L2-L1:".ljust(18) + "x: " + x_tile_str.ljust(15) +
+                      "y: " + y_tile_str.ljust(15) + "dw: " + dw_tile_str.ljust(15))
+        logging.debug("    no. tiles:".ljust(18) + "x: " + str(int(math.ceil(h_out / tile_h_out))).ljust(15))
+        logging.debug("    Total L1 occupation:".ljust(18) + str(self.fused_dw_pw_l1_occupation(n_out, BN, tile_h_in, tile_h_out)).ljust(15))
+        if self.cost_model is not None:
+            logging.debug("    Predicted cycles:".ljust(18) + str(predicted_cycles).ljust(15) + "(fused kernel)")
+        in_dim, out_dim, weights_dim, l1_dim = print_template_layer_fused(
+            n_in, h_in, w_in,
+            n_out, h_out, w_out,
+            tile_h_in, tile_h_out,
+            ds_x, ds_y, ds_W, self.BitActivation, type_data,
+            fs1, fs2, self.padding[0], self.padding[2], self.padding[1], self.padding[3], s,
+            relu, BN,
+            out_mul, out_shift, pw_out_mul, pw_out_shift,
+            name_layer=name,
+            l1_buffer=self.buffer_size,
+            chip=self.chip,
+            sdk=self.sdk,
+            dma_parallelization=self.dma_parallelization)
+        return in_dim, out_dim, weights_dim, l1_dim, 0, 1, 1, 1
+
     def get_tiling_pool2d(self, X, Y, W,
                           type_data='char',
                           relu=0,  BN = 0,
@@ -1850,6 +2411,9 @@ class Tiling():
         if tiling is not None:
 
             tile_n, tile_n, tile_h_in, tile_h_out, tile_w_in, tile_w_out = tiling
+            if L3_tiling == 0:
+                self.inplace_offset = self.inplace_output_offset(n_in, n_out, h_in, w_in, h_out, w_out,
+                                                                 tile_n, tile_n, tile_h_out, tile_w_out, s, p_top)
             x_tot_str = '[%dx%dx%d]' % (n_in, h_in, w_in)
             y_tot_str = '[%dx%dx%d]' % (n_out, h_out, w_out)
             x_tot_size_str = "%.2f KiB" % (1. / 1024. * (ds_x * n_in * h_in * w_in / 8.)) if ds_x * n_in * h_in * w_in > 1024 else '%d B' % (ds_x * n_in * h_in * w_in / 8.)
@@ -2055,6 +2619,7 @@ class Tiling():
 
 
 
+    @cached_tiling
     def get_tiling_pool2d_like(self,
                                filter_size1,
                                filter_size2,
@@ -2187,7 +2752,8 @@ class Tiling():
                        out_mul2=0,
                        out_shift=0,
                        name='Add',
-                       type='Avg'
+                       type='Avg',
+                       inplace=0
                        ):
         # This function generate the layer function to be included in the project for the addition operation.
 
@@ -2217,6 +2783,11 @@ class Tiling():
         # this is to renormalize all costs
         max_obj_value = sys.maxsize
         memory = ds_x * n_in * h_in * w_in * 2 + ds_y * n_out * h_out * w_out
+        # elementwise: with the same precision, each output byte overwrites the input byte it is computed from.
+        # inplace=1 when one of the inputs is not read after this layer, so that the output can take its L2
+        if inplace == 1 and ds_x == ds_y:
+            memory = ds_x * n_in * h_in * w_in * 2
+            self.inplace_offset = 0
         if memory >= self.L2_buffer_size * 8:
             print("  Add ERROR: no tiling from L3 supported. Exiting...")
             os._exit(0)            
@@ -0,0 +1,100 @@
+#
+# tiling_cache.py
+# Alessio Burrello <alessio.burrello@unibo.it>
+#
+# Copyright (C) 2019-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import hashlib
+import json
+import os
+import functools
+
+try:
+    from ortools import __version__ as solver_version
+except ImportError:
+    solver_version = 'unknown'
+
+
+def sources_hash():
+    # hash of the sources of the tilers and of the cost model: any change of their constraints, objective or
+    # parameters gives new keys, so that the entries of the previous version are simply never hit again.
+    digest = hashlib.sha1()
+    for module in ['tiling.py', 'cost_model.py', 'tiling_cache.py']:
+        with open(os.path.join(os.path.dirname(os.path.abspath(__file__)), module), 'rb') as f:
+            digest.update(f.read())
+    return digest.hexdigest()
+
+
+SOURCES_HASH = sources_hash()
+
+# attributes of the Tiling object that define the layer and the memory budget
+TILING_ATTRIBUTES = ['module', 'out_ch', 'filter_size', 'stride', 'padding', 'groups', 'x_shape',
+                     'buffer_size', 'L2_buffer_size', 'chip', 'BitIn', 'BitW', 'BitOut', 'BitActivation', 'optional_type',
+                     'dma_parallelization', 'cost_model']
+
+
+class Tiling_cache():
+    # Content-addressed on-disk cache of the tiling solutions.
+    # Each solution is stored in a small json file named after the hash of the layer signature,
+    # of the L1/L2 budget, of all the solver arguments, of the solver version and of the sources of the tilers.
+    def __init__(self, cache_dir='./tiling_cache/'):
+        self.cache_dir = cache_dir
+        self.hits = 0
+        self.misses = 0
+        os.makedirs(self.cache_dir, exist_ok=True)
+
+    def key(self, function_name, signature):
+        stringa = json.dumps([SOURCES_HASH, solver_version, function_name, signature], sort_keys=True, default=str)
+        return hashlib.sha1(stringa.encode()).hexdigest()
+
+    def get(self, key):
+        try:
+            with open(os.path.join(self.cache_dir, key + '.json'), 'r') as f:
+                value = json.load(f)
+        except (IOError, ValueError):
+            self.misses += 1
+            return None
+        self.hits += 1
+        return tuple(value)
+
+    def put(self, key, value):
+        # written to a temporary file and renamed, so that concurrent runs never read partial entries
+        file_name = os.path.join(self.cache_dir, key + '.json')
+        with open(file_name + '.' + str(os.getpid()), 'w') as f:
+            json.dump([int(v) for v in value], f)
+        os.replace(file_name + '.' + str(os.getpid()), file_name)
+
+    def print_statistics(self):
+        total = self.hits + self.misses
+        print("Tiling cache " + self.cache_dir + ": " + str(self.hits) + " hits, " + str(self.misses) + " misses" +
+              (" (" + str(int(100 * self.hits / total)) + "% hit rate)" if total > 0 else ""))
+
+
+def cached_tiling(function):
+    # Decorator for the Tiling methods that run a CP solver.
+    # The solution is looked up in self.cache before solving and stored in it afterwards.
+    @functools.wraps(function)
+    def wrapper(self, *args, **kwargs):
+        if getattr(self, 'cache', None) is None:
+            return function(self, *args, **kwargs)
+        signature = [[getattr(self, attribute) for attribute in TILING_ATTRIBUTES], list(args), sorted(kwargs.items())]
+        key = self.cache.key(function.__name__, signature)
+        solution = self.cache.get(key)
+        if solution is None:
+            solution = function(self, *args, **kwargs)
+            if solution is not None:
+                self.cache.put(key, solution)
+        return solution
+    return wrapper
@@ -0,0 +1,80 @@
+#
+# tiling_exploration.py
+# Alessio Burrello <alessio.burrello@unibo.it>
+#
+# Copyright (C) 2019-2020 University of Bologna
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+import csv
+import json
+import os
+
+LAYER_FIELDS = ['name', 'tile_n_in', 'tile_n_out', 'tile_h_in', 'tile_h_out', 'tile_w_in', 'tile_w_out',
+                'n_buffers', 'n_tiles', 'L1_bytes', 'DMA_commands', 'predicted_cycles', 'pareto', 'selected']
+SUMMARY_FIELDS = ['L1_budget', 'feasible_layers', 'predicted_cycles', 'DMA_commands']
+
+
+class Tiling_exploration():
+    # Collects, for each layer, the non-dominated L2-L1 tilings found by Tiling.explore_conv2d_like
+    # and writes them in csv and json, together with a network level summary:
+    # for each L1 budget, the predicted cycles of the network if each layer took its fastest tiling within the budget.
+    # Only conv2d like layers (convolutions, depthwise, fully connected) are explored.
+    def __init__(self, log_dir='./logs/'):
+        self.log_dir = log_dir
+        self.layers = []
+        os.makedirs(self.log_dir, exist_ok=True)
+
+    def add_layer(self, name, points):
+        self.layers.append((name, points))
+
+    def summary(self):
+        budgets = sorted(set(point['L1_bytes'] for _, points in self.layers for point in points if point['pareto'] == 1))
+        rows = []
+        for budget in budgets:
+            feasible_layers, cycles, commands = 0, 0, 0
+            for _, points in self.layers:
+                fitting = [point for point in points if point['pareto'] == 1 and point['L1_bytes'] <= budget]
+                if len(fitting) == 0:
+                    continue
+                best = min(fitting, key=lambda point: (point['predicted_cycles'], point['DMA_commands']))
+                feasible_layers += 1
+                cycles += best['predicted_cycles']
+                commands += best['DMA_commands']
+            # the totals are meaningful only when all the layers fit the budget
+            if feasible_layers < len(self.layers):
+                cycles, commands = '', ''
+            rows.append({'L1_budget': budget, 'feasible_layers': feasible_layers, 'predicted_cycles': cycles,
+                         'DMA_commands': commands})
+        return rows
+
+    def write(self, file_name='Tiling_exploration'):
+        rows = []
+        for name, points in self.layers:
+            for point in points:
+                row = dict(point)
+                row['name'] = name
+                rows.append(row)
+        summary = self.summary()
+        with open(os.path.join(self.log_dir, file_name + '.csv'), 'w', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=LAYER_FIELDS)
+            writer.writeheader()
+            writer.writerows(rows)
+        with open(os.path.join(self.log_dir, file_name + '_summary.csv'), 'w', newline='') as f:
+            writer = csv.DictWriter(f, fieldnames=SUMMARY_FIELDS)
+            writer.writeheader()
+            writer.writerows(summary)
+        with open(os.path.join(self.log_dir, file_name + '.json'), 'w') as f:
+            json.dump({'layers': rows, 'summary': summary}, f, indent=4)
+        print("Tiling exploration of " + str(len(self.layers)) + " layers written in " + os.path.join(self.log_dir, file_name + '.csv') +
+              " and " + file_name + "_summary.csv")